@@ -0,0 +1,133 @@
+/*
+ * Ambient light sensing
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "LPC11Uxx.h"
+
+#include "ambient.h"
+#include "isr_stats.h"
+#include "util.h"
+
+#define AMBIENT_CHANNEL 5
+
+/* Fractional bits kept in the filter state */
+#define IIR_FRAC 6
+
+/*
+ * ADC clock must be <= 4.5 MHz. This is fine at 48 MHz, and just slower
+ * at lower clocks
+ */
+#define ADC_CLKDIV 10
+
+#define ADC_CR_START_CT32B0_MAT0 (4 << 24)
+#define ADC_DR_DONE (1u << 31)
+
+/* Light level (ADC counts) to brightness, linear in between points */
+static const struct ambient_point {
+	uint16_t level;
+	uint16_t brightness;
+} curve[] = {
+	{ 0x000, 0x0800 },
+	{ 0x020, 0x1800 },
+	{ 0x080, 0x4000 },
+	{ 0x180, 0xa000 },
+	{ 0x300, 0xffff },
+	{ 0x3ff, 0xffff },
+};
+
+static struct {
+	bool primed;
+	/* Filtered level, with IIR_FRAC fractional bits */
+	int32_t filtered;
+	/* Level the brightness was last worked out for */
+	uint16_t level;
+	uint16_t target;
+	volatile uint16_t brightness;
+} ambient;
+
+static uint16_t curve_lookup(uint16_t level)
+{
+	unsigned int i;
+
+	for (i = 1; i < sizeof(curve) / sizeof(curve[0]) - 1; i++) {
+		if (level < curve[i].level)
+			break;
+	}
+
+	return lerp(curve[i - 1].brightness, curve[i].brightness,
+			level - curve[i - 1].level,
+			curve[i].level - curve[i - 1].level);
+}
+
+void ADC_Handler(void)
+{
+	ISR_STATS_ENTER();
+	/* Reading the data register clears the interrupt */
+	uint32_t dr = LPC_ADC->DR[AMBIENT_CHANNEL];
+	int32_t sample = (dr >> 6) & 0x3ff;
+	int32_t level;
+
+	if (!(dr & ADC_DR_DONE))
+		goto out;
+
+	if (!ambient.primed) {
+		ambient.filtered = sample << IIR_FRAC;
+		ambient.level = sample;
+		ambient.target = curve_lookup(sample);
+		ambient.brightness = ambient.target;
+		ambient.primed = true;
+		goto out;
+	}
+
+	ambient.filtered += ((sample << IIR_FRAC) - ambient.filtered) >>
+		AMBIENT_IIR_SHIFT;
+
+	/* Only re-do the curve when the level has moved far enough */
+	level = ambient.filtered >> IIR_FRAC;
+	if ((level > ambient.level + AMBIENT_HYSTERESIS) ||
+	    (level < ambient.level - AMBIENT_HYSTERESIS)) {
+		ambient.level = level;
+		ambient.target = curve_lookup(level);
+	}
+
+	ambient.brightness = slew(ambient.brightness, ambient.target,
+			AMBIENT_SLEW_STEP);
+out:
+	ISR_STATS_EXIT(ISR_ADC);
+}
+
+void ambient_init(void)
+{
+	/* AD5, analog mode, no pull-up */
+	set_with_mask(&LPC_IOCON->PIO0_16, 0x9f, 0x01);
+
+	LPC_SYSCON->PDRUNCFG &= ~(1 << 4);
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 13);
+
+	NVIC_SetPriority(ADC_IRQn, 3);
+	NVIC_EnableIRQ(ADC_IRQn);
+
+	LPC_ADC->INTEN = (1 << AMBIENT_CHANNEL);
+	LPC_ADC->CR = (1 << AMBIENT_CHANNEL) | (ADC_CLKDIV << 8) |
+		ADC_CR_START_CT32B0_MAT0;
+
+	/*
+	 * The animation timer resets on MR3 every 10 ms. Toggle MAT0 half
+	 * way through, and start a conversion on each rising edge: one every
+	 * 20 ms.
+	 */
+	LPC_CT32B0->MR0 = LPC_CT32B0->MR3 / 2;
+	LPC_CT32B0->EMR = (LPC_CT32B0->EMR & ~(0x3 << 4)) | (0x3 << 4);
+}
+
+uint16_t ambient_level(void)
+{
+	return ambient.level;
+}
+
+uint16_t ambient_brightness(void)
+{
+	return ambient.brightness;
+}
@@ -0,0 +1,36 @@
+/*
+ * Ambient light sensing, on AD5 (PIO0_16)
+ *
+ * Expects a light-dependent divider on the pin, with the voltage rising
+ * with the light level. Conversions are triggered in hardware from the
+ * animation timer, and filtered in the ADC interrupt, so there's nothing
+ * to poll.
+ */
+#ifndef __AMBIENT_H__
+#define __AMBIENT_H__
+#include <stdint.h>
+
+/* IIR filter time constant, in samples (1 << AMBIENT_IIR_SHIFT) */
+#define AMBIENT_IIR_SHIFT  4
+/* Filtered level has to move this far (in ADC counts) to count */
+#define AMBIENT_HYSTERESIS 8
+/*
+ * Maximum brightness change per sample - full scale in ~5 s. Samples
+ * follow the animation tick, so at night (see display_set_night()) they
+ * come every 80 ms, and the slew is four times slower.
+ */
+#define AMBIENT_SLEW_STEP  0x0100
+
+/*
+ * Start sampling. Uses CT32B0 MR0 as the trigger, so must be called after
+ * display_init() has set up the timer.
+ */
+void ambient_init(void);
+
+/* Filtered light level, in ADC counts (0 - 0x3ff) */
+uint16_t ambient_level(void);
+
+/* Brightness for the current light level, from the curve (0 - 0xffff) */
+uint16_t ambient_brightness(void);
+
+#endif /* __AMBIENT_H__ */
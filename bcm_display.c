@@ -0,0 +1,406 @@
+/*
+ * Binary Code Modulation segment display implementation
+ *
+ * Drives one LED channel per segment from PIO0_8..15, with the brightness
+ * of each set by BCM from TIMER_16_0. TIMER_32_0 runs the fades.
+ *
+ * Copyright Brian Starkey 2015 <stark3y@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "LPC11Uxx.h"
+
+#include "isr_stats.h"
+#include "lut.h"
+#include "segment_display.h"
+#include "util.h"
+
+#define PIN_LED0 (1 << 15)
+#define PIN_LED1 (1 << 14)
+#define PIN_LED2 (1 << 13)
+#define PIN_LED3 (1 << 12)
+#define PIN_LED4 (1 << 11)
+#define PIN_LED5 (1 << 10)
+#define PIN_LED6 (1 <<  9)
+#define PIN_LED7 (1 <<  8)
+#define N_CHANNELS  8
+
+//#define DEBUG
+#ifdef DEBUG
+#define DBG_PORT (0)
+#define DBG_PIN  (1 << 19)
+#define DBG_PIN1  (1 << 18)
+#define DBG_HIGH()   LPC_GPIO->SET[DBG_PORT] = DBG_PIN
+#define DBG_LOW()    LPC_GPIO->CLR[DBG_PORT] = DBG_PIN
+#define DBG_TOGGLE() LPC_GPIO->NOT[DBG_PORT] = DBG_PIN
+#else
+#define DBG_HIGH() {}
+#define DBG_LOW()  {}
+#define DBG_TOGGLE() {}
+#endif
+
+#define PWM_CHANNELS   8
+#define PWM_RESOLUTION 10
+#define MIN_CYCLES_LOG2 2
+
+/*
+ * Timer rates, kept the same whatever the core clock is. The BCM tick
+ * needs to divide 12 MHz evenly, so that it doesn't change.
+ */
+#define BCM_TICK_HZ  800000
+#define ANIM_TICK_HZ 2000
+
+/*
+ * The shortest bit slot is (1 << MIN_CYCLES_LOG2) BCM ticks, and the
+ * handler has to be done inside it. It takes around 100 cycles from
+ * entry to exit, so don't run the core at a clock which would make the
+ * slot shorter than this - the timer would lap the handler.
+ */
+#define BCM_MIN_SLOT_CYCLES 200
+
+/* Animation tick period, in ANIM_TICK_HZ ticks */
+#define ANIM_PERIOD       20
+/* In night mode, refresh at half rate, and tick every 40 ms */
+#define NIGHT_BCM_DIV     2
+#define NIGHT_ANIM_PERIOD 80
+
+/* Full scale in DISPLAY_BRIGHTNESS_RAMP_MS, at one step per tick */
+#define MASTER_STEP(_period) \
+	((0xffff * (_period)) / ((DISPLAY_BRIGHTNESS_RAMP_MS * ANIM_TICK_HZ) / 1000))
+
+/* PWM channel for each segment */
+const uint8_t channel_map[] = {
+	1, /* BREAKFAST */
+	3, /* LUNCH */
+	4, /* HOME */
+	5, /* DINNER */
+	6, /* BED */
+	2, /* NEARLY */
+	0, /* PAST */
+	7, /* ITS_TIME */
+};
+
+struct segment_display {
+	/* Master brightness, slewing from 'master' to 'master_target' */
+	volatile uint16_t master;
+	volatile uint16_t master_target;
+	/* Master change per tick, which depends on the tick period */
+	volatile uint16_t master_step;
+	/* Relative brightness of each segment. No colour here */
+	uint16_t segment_brightness[N_CHANNELS];
+	bool night;
+} bcm_display = {
+	.master = 0xffff,
+	.master_target = 0xffff,
+	.master_step = MASTER_STEP(ANIM_PERIOD),
+	.segment_brightness = {
+		0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff,
+	},
+};
+
+volatile uint32_t bitslices[2][PWM_RESOLUTION];
+volatile uint8_t in_use_set = 0;
+volatile uint8_t queued_set = 0;
+volatile uint16_t values[PWM_CHANNELS];
+
+volatile uint32_t bcm_isr_count;
+volatile uint32_t anim_isr_count;
+
+RAMFUNC void TIMER_16_0_Handler(void) {
+	static int bit = 0;
+	static int dir = 1;
+	static uint32_t period = (1 << MIN_CYCLES_LOG2);
+	static volatile uint32_t *set = bitslices[0];
+	ISR_STATS_ENTER();
+
+	DBG_HIGH();
+	LPC_CTxxBx_Type *timer = LPC_CT16B0;
+	uint32_t status = timer->IR;
+	bcm_isr_count++;
+
+	if (status & (1 << 3)) {
+		/*
+		 * Fun fact: You can't use reset-on-match mode and change the
+		 * match value in the interrupt handler.
+		 * The reset happens 1 prescaled clock cycle after the match
+		 * interrupt, which means if you change the match here, the
+		 * reset for the old match doesn't happen.
+		 * You can spin waiting for the reset before changing the MR,
+		 * but that blows my timing budget:
+		 *     while (timer->MR3 >= period - 1);
+		 * Instead, we clear the counter manually. It will introduce
+		 * some jitter, but ultimately is probably fine.
+		 */
+		timer->TC = 0;
+		timer->MR3 = period - 1;
+
+		LPC_GPIO->MPIN[0] = set[bit];
+		bit += dir;
+
+#ifdef DEBUG
+		LPC_GPIO->NOT[DBG_PORT] = DBG_PIN1;
+#endif
+		if (dir > 0 && bit == PWM_RESOLUTION) {
+			in_use_set = queued_set;
+			set = bitslices[in_use_set];
+			bit = PWM_RESOLUTION - 1;
+			dir = -1;
+		} else if (dir < 0 && bit == -1) {
+			in_use_set = queued_set;
+			set = bitslices[in_use_set];
+			bit = 0;
+			dir = 1;
+		}
+		period = 1 << (MIN_CYCLES_LOG2 + bit);
+	}
+	timer->IR = status;
+	DBG_LOW();
+	ISR_STATS_EXIT(ISR_BCM);
+}
+
+static void init_timer16(void)
+{
+	LPC_CTxxBx_Type *timer = LPC_CT16B0;
+
+	NVIC_SetPriority(TIMER_16_0_IRQn, 0);
+	NVIC_EnableIRQ(TIMER_16_0_IRQn);
+
+	/* Turn on the clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 7);
+
+	timer->PR = (SystemCoreClock / BCM_TICK_HZ) - 1;
+
+	/* Use MR3 as overflow interupt */
+	timer->MR3 = 0;
+	timer->MCR = (1 << 9);
+	timer->TCR = 0x1;
+}
+
+RAMFUNC void pwm_flip() {
+	int i;
+	uint16_t mask = 1 << (16 - PWM_RESOLUTION);
+
+	/*
+	 * If previous flip hasn't completed, we try to cancel it.
+	 * The timer routing will race with us, but all possibilities are
+	 * fine:
+	 *  - If the timer already swapped, then the condition is false and we're fine
+	 *  - If the timer swaps in between the check and the set, then queued_set
+	 *    simply doesn't change
+	 *  - If both the check and set happen before the timer swaps, then the
+	 *    previous flip is cancelled
+	 */
+	if (queued_set != in_use_set) {
+		NVIC_DisableIRQ(TIMER_16_0_IRQn);
+		queued_set = in_use_set;
+		NVIC_EnableIRQ(TIMER_16_0_IRQn);
+	}
+
+	volatile uint32_t *slice = bitslices[!queued_set];
+	for (i = 0; i < PWM_RESOLUTION; i++, mask <<= 1) {
+		slice[i] = (
+			   ((values[0] & mask) ? PIN_LED0 : 0) |
+			   ((values[1] & mask) ? PIN_LED1 : 0) |
+			   ((values[2] & mask) ? PIN_LED2 : 0) |
+			   ((values[3] & mask) ? PIN_LED3 : 0) |
+			   ((values[4] & mask) ? PIN_LED4 : 0) |
+			   ((values[5] & mask) ? PIN_LED5 : 0) |
+			   ((values[6] & mask) ? PIN_LED6 : 0) |
+			   ((values[7] & mask) ? PIN_LED7 : 0)
+		);
+	}
+	queued_set = !queued_set;
+}
+
+RAMFUNC void pwm_set(uint8_t channel, uint16_t value) {
+	values[channel] = lut1d(value);
+}
+
+void leds_init(void)
+{
+	/* Set all our LED pins as GPIO outputs */
+	set_with_mask(&LPC_IOCON->PIO0_8, 0x3, 0x0);
+	set_with_mask(&LPC_IOCON->PIO0_9, 0x3, 0x0);
+	set_with_mask(&LPC_IOCON->SWCLK_PIO0_10, 0x3, 0x1);
+	set_with_mask(&LPC_IOCON->TDI_PIO0_11, 0x3, 0x1);
+	set_with_mask(&LPC_IOCON->TMS_PIO0_12, 0x3, 0x1);
+	set_with_mask(&LPC_IOCON->TDO_PIO0_13, 0x3, 0x1);
+	set_with_mask(&LPC_IOCON->TRST_PIO0_14, 0x3, 0x1);
+	set_with_mask(&LPC_IOCON->SWDIO_PIO0_15, 0x3, 0x1);
+	LPC_GPIO->DIR[0] |= (0xFF << 8);
+
+	LPC_GPIO->MASK[0] = ~(PIN_LED0 | PIN_LED1 | PIN_LED2 | PIN_LED3 | PIN_LED4 | PIN_LED5 | PIN_LED6 | PIN_LED7);
+}
+
+// TIMER_32_0 drives the animations, ticking every 10ms
+static void init_timer32()
+{
+	LPC_CTxxBx_Type *timer = LPC_CT32B0;
+
+	NVIC_SetPriority(TIMER_32_0_IRQn, 3);
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+
+	/* Turn on the clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 9);
+
+	timer->PR = (SystemCoreClock / ANIM_TICK_HZ) - 1;
+
+	/* 10 ms overflow */
+	timer->MR3 = ANIM_PERIOD;
+	timer->MCR = (1 << 9) | (1 << 10);
+	timer->TCR = 0x1;
+}
+
+const uint32_t anim_length = 2048;
+volatile uint32_t anim_start;
+uint16_t state[N_CHANNELS];
+uint16_t start[N_CHANNELS];
+uint16_t target[N_CHANNELS];
+
+RAMFUNC void TIMER_32_0_Handler(void)
+{
+	ISR_STATS_ENTER();
+	struct segment_display *disp = &bcm_display;
+	uint32_t status = LPC_CT32B0->IR;
+	anim_isr_count++;
+	if (status & (1 << 3)) {
+		uint32_t tmp = ms_since(anim_start);
+		uint32_t master = disp->master;
+		bool all = false;
+
+		if (master != disp->master_target) {
+			master = slew(master, disp->master_target,
+					disp->master_step);
+			disp->master = master;
+			all = true;
+		}
+
+		uint32_t i, val = 0;
+		for (i = 0; i < N_CHANNELS; i++) {
+			if (state[i] != target[i]) {
+				val = lerp(start[i], target[i], tmp, anim_length);
+				state[i] = val;
+			} else if (!all) {
+				continue;
+			}
+			pwm_set(channel_map[i], (state[i] * master) >> 16);
+		}
+
+		pwm_flip();
+	}
+	LPC_CT32B0->IR = status;
+	ISR_STATS_EXIT(ISR_ANIM);
+}
+
+struct segment_display *display_init(void)
+{
+#ifdef DEBUG
+	LPC_GPIO->DIR[DBG_PORT] |= DBG_PIN | DBG_PIN1;
+	LPC_GPIO->CLR[DBG_PORT] = DBG_PIN | DBG_PIN1;
+#endif
+
+	leds_init();
+	init_timer32();
+	init_timer16();
+
+	return &bcm_display;
+}
+
+void display_clock_changed(struct segment_display *disp)
+{
+	uint32_t bcm_hz = BCM_TICK_HZ;
+
+	if (disp->night)
+		bcm_hz /= NIGHT_BCM_DIV;
+
+	/* Clear the prescale counters, in case they're past the new PR */
+	LPC_CT16B0->PR = (SystemCoreClock / bcm_hz) - 1;
+	LPC_CT16B0->PC = 0;
+	LPC_CT32B0->PR = (SystemCoreClock / ANIM_TICK_HZ) - 1;
+	LPC_CT32B0->PC = 0;
+}
+
+bool display_clock_ok(struct segment_display *disp, enum clock_speed speed)
+{
+	uint32_t bcm_hz = BCM_TICK_HZ;
+
+	if (disp->night)
+		bcm_hz /= NIGHT_BCM_DIV;
+
+	/* BCM_TICK_HZ divides all of them, but the slots get too short */
+	return ((clock_core_hz(speed) / bcm_hz) << MIN_CYCLES_LOG2) >=
+		BCM_MIN_SLOT_CYCLES;
+}
+
+void display_set_night(struct segment_display *disp, bool night)
+{
+	disp->night = night;
+	disp->master_step = MASTER_STEP(night ? NIGHT_ANIM_PERIOD : ANIM_PERIOD);
+	display_clock_changed(disp);
+
+	/* Clear the counter too, in case it's past the new MR3 */
+	LPC_CT32B0->MR3 = night ? NIGHT_ANIM_PERIOD : ANIM_PERIOD;
+	LPC_CT32B0->TC = 0;
+}
+
+void display_set_brightness(struct segment_display *disp, uint16_t brightness)
+{
+	disp->master_target = brightness;
+}
+
+void display_set_color(struct segment_display *disp, int segment,
+		uint32_t rgb, uint16_t brightness)
+{
+	(void)rgb;
+	disp->segment_brightness[segment] = brightness;
+}
+
+void display_transition(struct segment_display *disp,
+		segment_mask from, segment_mask to)
+{
+	int i;
+	(void)from;
+
+	NVIC_DisableIRQ(TIMER_32_0_IRQn);
+	for (i = 0; i < N_CHANNELS; i++) {
+		start[i] = state[i];
+		if (to & (1 << i)) {
+			target[i] = disp->segment_brightness[i];
+		} else {
+			target[i] = 0;
+		}
+	}
+	anim_start = msTicks;
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+}
+
+void display_get_levels(struct segment_display *disp, uint16_t *level,
+		uint16_t *to)
+{
+	int i;
+	(void)disp;
+
+	for (i = 0; i < N_CHANNELS; i++) {
+		level[i] = state[i];
+		to[i] = target[i];
+	}
+}
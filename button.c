@@ -0,0 +1,215 @@
+/*
+ * Push button on PIO0_1, with gesture decoding
+ *
+ * The pin interrupt fires on both edges, and only records the time and new
+ * level in a queue. Everything else - debouncing and working out the
+ * gestures - happens in button_poll(), from the timestamps. No timer is
+ * needed.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "LPC11Uxx.h"
+
+#include "button.h"
+#include "isr_stats.h"
+#include "util.h"
+
+#define BUTTON_PORT 0
+#define BUTTON_PIN  1
+
+/* Must be a power of 2 */
+#define QUEUE_LEN 16
+
+struct button_edge {
+	uint32_t time;
+	bool pressed;
+};
+
+/*
+ * Single producer (the interrupt) and single consumer (button_poll()).
+ * Only the interrupt writes head, and only button_poll() writes tail.
+ */
+static struct button_edge queue[QUEUE_LEN];
+static volatile uint8_t head, tail;
+static volatile bool overflow;
+
+/* Debouncer state */
+static bool raw_pressed;
+static uint32_t raw_time;
+static bool pressed;
+
+/* Gesture decoder state */
+static uint32_t press_time, release_time, repeat_time;
+static bool long_sent;
+static bool short_waiting;
+
+static bool button_read(void)
+{
+	/* Active low */
+	return !(LPC_GPIO->PIN[BUTTON_PORT] & (1 << BUTTON_PIN));
+}
+
+void WAKEUP0_Handler(void)
+{
+	ISR_STATS_ENTER();
+	uint32_t stat = LPC_GPIO_PIN_INT->IST;
+
+	if (stat & 1) {
+		uint8_t next = (head + 1) & (QUEUE_LEN - 1);
+
+		LPC_GPIO_PIN_INT->RISE = (1 << 0);
+		LPC_GPIO_PIN_INT->FALL = (1 << 0);
+
+		if (next == tail) {
+			overflow = true;
+		} else {
+			queue[head].time = msTicks;
+			queue[head].pressed = button_read();
+			/* Entry must be written before it's published */
+			barrier();
+			head = next;
+		}
+	}
+	LPC_GPIO_PIN_INT->IST = stat;
+	ISR_STATS_EXIT(ISR_BUTTON);
+}
+
+void button_init(void)
+{
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 19);
+
+	NVIC_SetPriority(FLEX_INT0_IRQn, 3);
+	NVIC_EnableIRQ(FLEX_INT0_IRQn);
+
+	/* Edge triggered, both edges */
+	LPC_SYSCON->PINTSEL[0] = (BUTTON_PORT * 24) + BUTTON_PIN;
+	LPC_GPIO_PIN_INT->ISEL &= ~(1 << 0);
+	LPC_GPIO_PIN_INT->RISE = (1 << 0);
+	LPC_GPIO_PIN_INT->FALL = (1 << 0);
+	LPC_GPIO_PIN_INT->SIENR = (1 << 0);
+	LPC_GPIO_PIN_INT->SIENF = (1 << 0);
+}
+
+bool button_pending(void)
+{
+	return (head != tail) || overflow;
+}
+
+/*
+ * Feed one raw edge to the debouncer. A level only counts once it's been
+ * stable for BUTTON_DEBOUNCE_MS, which we know for sure when the next edge
+ * arrives (or time passes without one).
+ * Returns true if the debounced state changed, with its time in *time.
+ */
+static bool debounce(uint32_t now, uint32_t *time)
+{
+	if ((raw_pressed != pressed) &&
+	    (now - raw_time >= BUTTON_DEBOUNCE_MS)) {
+		pressed = raw_pressed;
+		*time = raw_time;
+		return true;
+	}
+
+	return false;
+}
+
+static enum button_event decode(uint32_t time)
+{
+	if (pressed) {
+		enum button_event ev = BUTTON_NONE;
+
+		/* Too late to be a double, if we didn't notice already */
+		if (short_waiting && (time - release_time >= BUTTON_DOUBLE_MS)) {
+			short_waiting = false;
+			ev = BUTTON_SHORT;
+		}
+
+		press_time = time;
+		repeat_time = time;
+		long_sent = false;
+		return ev;
+	}
+
+	if (long_sent || (time - press_time >= BUTTON_SHORT_MS)) {
+		short_waiting = false;
+		return BUTTON_NONE;
+	}
+
+	/* Second short press */
+	if (short_waiting && (press_time - release_time < BUTTON_DOUBLE_MS)) {
+		short_waiting = false;
+		return BUTTON_DOUBLE;
+	}
+
+	/* Wait to see if it's a double */
+	short_waiting = true;
+	release_time = time;
+
+	return BUTTON_NONE;
+}
+
+enum button_event button_poll(void)
+{
+	enum button_event ev;
+	uint32_t now = msTicks;
+	uint32_t time;
+
+	while (tail != head) {
+		struct button_edge *e = &queue[tail];
+
+		/* Don't read the entry until we've seen head move past it */
+		barrier();
+
+		/* The previous level may have settled before this edge */
+		if (debounce(e->time, &time)) {
+			ev = decode(time);
+			if (ev != BUTTON_NONE)
+				return ev;
+		}
+
+		raw_pressed = e->pressed;
+		raw_time = e->time;
+		/* Finish with the entry before handing it back */
+		barrier();
+		tail = (tail + 1) & (QUEUE_LEN - 1);
+	}
+
+	if (overflow) {
+		/* Lost some edges, so resync with the pin */
+		overflow = false;
+		raw_pressed = button_read();
+		raw_time = now;
+	}
+
+	if (debounce(now, &time)) {
+		ev = decode(time);
+		if (ev != BUTTON_NONE)
+			return ev;
+	}
+
+	/*
+	 * Time-based events. If a second press has started but isn't
+	 * debounced yet, hold off the short press until we know whether it's
+	 * a double.
+	 */
+	if (short_waiting && !pressed && !raw_pressed &&
+	    (now - release_time >= BUTTON_DOUBLE_MS)) {
+		short_waiting = false;
+		return BUTTON_SHORT;
+	}
+
+	if (pressed && !long_sent && (now - press_time >= BUTTON_LONG_MS)) {
+		long_sent = true;
+		short_waiting = false;
+		repeat_time = now;
+		return BUTTON_LONG;
+	}
+
+	if (pressed && long_sent && (now - repeat_time >= BUTTON_REPEAT_MS)) {
+		repeat_time += BUTTON_REPEAT_MS;
+		return BUTTON_REPEAT;
+	}
+
+	return BUTTON_NONE;
+}
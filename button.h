@@ -0,0 +1,41 @@
+/*
+ * Push button on PIO0_1, with gesture decoding
+ */
+#ifndef __BUTTON_H__
+#define __BUTTON_H__
+#include <stdbool.h>
+
+enum button_event {
+	BUTTON_NONE,
+	/* Pressed and released, and not pressed again soon after */
+	BUTTON_SHORT,
+	/* Two short presses close together */
+	BUTTON_DOUBLE,
+	/* Held down for BUTTON_LONG_MS */
+	BUTTON_LONG,
+	/* Still held, every BUTTON_REPEAT_MS after BUTTON_LONG */
+	BUTTON_REPEAT,
+};
+
+/* Press must be stable this long to count */
+#define BUTTON_DEBOUNCE_MS 30
+/* Presses longer than this aren't short */
+#define BUTTON_SHORT_MS    1000
+/* Second press must start within this long of the first release */
+#define BUTTON_DOUBLE_MS   300
+#define BUTTON_LONG_MS     3000
+#define BUTTON_REPEAT_MS   500
+
+void button_init(void);
+
+/* Returns true if the button has changed since the last button_poll() */
+bool button_pending(void);
+
+/* Decode any button activity
+ *
+ * Must be called regularly from the main loop. Returns the next gesture,
+ * or BUTTON_NONE. Call again until it returns BUTTON_NONE to get them all.
+ */
+enum button_event button_poll(void);
+
+#endif /* __BUTTON_H__ */
@@ -0,0 +1,110 @@
+/*
+ * Core clock switching
+ */
+#include <stdint.h>
+
+#include "LPC11Uxx.h"
+
+#include "clock.h"
+#include "util.h"
+
+#define MAINCLKSEL_IRC    0
+#define MAINCLKSEL_PLLOUT 3
+#define IRC_HZ            12000000
+#define PLL_HZ            48000000
+#define PDRUNCFG_SYSPLL   (1 << 7)
+
+static const struct clock_config {
+	uint8_t mainclksel;
+	uint8_t div;
+	/* Flash access time, in extra clocks. 1 above 20 MHz, 2 above 40 */
+	uint8_t flashtim;
+} configs[] = {
+	[CLOCK_48MHZ] = { MAINCLKSEL_PLLOUT, 1, 2 },
+	[CLOCK_24MHZ] = { MAINCLKSEL_PLLOUT, 2, 1 },
+	[CLOCK_12MHZ] = { MAINCLKSEL_PLLOUT, 4, 0 },
+	[CLOCK_IRC]   = { MAINCLKSEL_IRC,    1, 0 },
+};
+
+/* SystemInit() leaves us running from the PLL, undivided */
+static enum clock_speed current = CLOCK_48MHZ;
+
+static void set_mainclksel(uint8_t sel)
+{
+	if (LPC_SYSCON->MAINCLKSEL == sel)
+		return;
+
+	LPC_SYSCON->MAINCLKSEL = sel;
+	LPC_SYSCON->MAINCLKUEN = 0x01;
+	LPC_SYSCON->MAINCLKUEN = 0x00;
+	LPC_SYSCON->MAINCLKUEN = 0x01;
+	while (!(LPC_SYSCON->MAINCLKUEN & 0x01));
+}
+
+int clock_set(enum clock_speed speed)
+{
+	const struct clock_config *from, *to;
+
+	if (speed > CLOCK_IRC)
+		return -1;
+	if (speed == current)
+		return 0;
+
+	from = &configs[current];
+	to = &configs[speed];
+
+	if (to->mainclksel == MAINCLKSEL_PLLOUT) {
+		LPC_SYSCON->PDRUNCFG &= ~PDRUNCFG_SYSPLL;
+		while (!(LPC_SYSCON->SYSPLLSTAT & 0x01));
+	}
+
+	__disable_irq();
+
+	/* The flash has to be slow enough for both the old and new clocks */
+	if (to->flashtim > from->flashtim)
+		set_with_mask(&LPC_FLASHCTRL->FLASHCFG, 0x3, to->flashtim);
+
+	/*
+	 * Order the switch so the clock never goes above the higher of the
+	 * two: drop to the IRC before removing the divider, and divide
+	 * before going back to the PLL.
+	 */
+	if (to->mainclksel == MAINCLKSEL_IRC) {
+		set_mainclksel(to->mainclksel);
+		LPC_SYSCON->SYSAHBCLKDIV = to->div;
+	} else {
+		LPC_SYSCON->SYSAHBCLKDIV = to->div;
+		set_mainclksel(to->mainclksel);
+	}
+
+	if (to->flashtim < from->flashtim)
+		set_with_mask(&LPC_FLASHCTRL->FLASHCFG, 0x3, to->flashtim);
+
+	SystemCoreClockUpdate();
+	SysTick->LOAD = (SystemCoreClock / 1000) - 1;
+	SysTick->VAL = 0;
+
+	current = speed;
+
+	__enable_irq();
+
+	if (to->mainclksel == MAINCLKSEL_IRC)
+		LPC_SYSCON->PDRUNCFG |= PDRUNCFG_SYSPLL;
+
+	return 0;
+}
+
+enum clock_speed clock_get(void)
+{
+	return current;
+}
+
+uint32_t clock_main_hz(enum clock_speed speed)
+{
+	return (configs[speed].mainclksel == MAINCLKSEL_IRC) ? IRC_HZ : PLL_HZ;
+}
+
+uint32_t clock_core_hz(enum clock_speed speed)
+{
+	return clock_main_hz(speed) / configs[speed].div;
+}
@@ -0,0 +1,33 @@
+/*
+ * Core clock switching
+ *
+ * The PLL runs at 48 MHz, and the core can run from it directly, divided
+ * down, or straight from the 12 MHz IRC with the PLL powered off. USB has
+ * its own PLL, so isn't affected.
+ *
+ * clock_set() re-tunes SysTick, so msTicks keeps counting milliseconds.
+ * Everything else which depends on SystemCoreClock needs to be told -
+ * for the display, call display_clock_changed() afterwards.
+ */
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+#include <stdint.h>
+
+enum clock_speed {
+	CLOCK_48MHZ,
+	CLOCK_24MHZ,
+	CLOCK_12MHZ,
+	/* 12 MHz, with the system PLL off */
+	CLOCK_IRC,
+};
+
+int clock_set(enum clock_speed speed);
+enum clock_speed clock_get(void);
+
+/* Main clock (before SYSAHBCLKDIV, which peripherals like SSP run from) */
+uint32_t clock_main_hz(enum clock_speed speed);
+
+/* Core clock (SystemCoreClock) at 'speed' */
+uint32_t clock_core_hz(enum clock_speed speed);
+
+#endif /* __CLOCK_H__ */
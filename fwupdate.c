@@ -0,0 +1,181 @@
+/* Fuzzy clock firmware updater
+ * Streams a checksummed firmware image to the clock over its USB serial
+ * port, using the UPDATE console command (see updater.h).
+ *
+ * Public domain. Provided as-is with no warranty whatsoever.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* Must match updater.h */
+#define CHUNK_SIZE 64
+#define WINDOW     2
+
+#define TIMEOUT_MS 5000
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+	int i;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+/* Read one character, or return -1 on timeout/error */
+int read_char(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char c;
+
+	if (poll(&pfd, 1, TIMEOUT_MS) != 1)
+		return -1;
+	if (read(fd, &c, 1) != 1)
+		return -1;
+
+	return c;
+}
+
+/* Read until 'str' has been seen. Returns -1 on timeout/error */
+int wait_for(int fd, const char *str)
+{
+	size_t matched = 0;
+	int c;
+
+	while (str[matched]) {
+		c = read_char(fd);
+		if (c < 0)
+			return -1;
+		if (c == str[matched])
+			matched++;
+		else
+			matched = (c == str[0]) ? 1 : 0;
+	}
+
+	return 0;
+}
+
+int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct termios tio;
+	uint8_t *image;
+	char cmd[32];
+	size_t size, sent = 0, acked = 0;
+	uint32_t crc;
+	FILE *in;
+	int fd, c;
+
+	if (argc != 3) {
+		printf("Usage: %s tty image_file\n"
+			   "\n"
+			   "Updates the firmware of a fuzzy clock over its USB serial port\n"
+			   "Arguments:\n"
+			   " tty: The clock's serial port, e.g. /dev/ttyACM0\n"
+			   " image_file: The checksummed binary (e.g. blink_checksum.bin)\n",
+			   argv[0]);
+		return 1;
+	}
+
+	in = fopen(argv[2], "r");
+	if (!in) {
+		fprintf(stderr, "Couldn't open image file\n");
+		return 1;
+	}
+	fseek(in, 0, SEEK_END);
+	size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	image = malloc(size);
+	if (!image || (fread(image, 1, size, in) != size)) {
+		fprintf(stderr, "Couldn't read image file\n");
+		fclose(in);
+		return 1;
+	}
+	fclose(in);
+	crc = crc32(0, image, size);
+
+	fd = open(argv[1], O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		fprintf(stderr, "Couldn't open %s\n", argv[1]);
+		return 1;
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIOFLUSH);
+
+	printf("Image: %zu bytes, CRC 0x%08x\n", size, crc);
+	snprintf(cmd, sizeof(cmd), "UPDATE 0x%08zx 0x%08x\r", size, crc);
+	if (write_all(fd, cmd, strlen(cmd)) || wait_for(fd, "READY\r\n")) {
+		fprintf(stderr, "Clock didn't accept the update\n");
+		return 1;
+	}
+
+	while (acked < size) {
+		while ((sent < size) && (sent - acked < WINDOW * CHUNK_SIZE)) {
+			size_t len = size - sent;
+			if (len > CHUNK_SIZE)
+				len = CHUNK_SIZE;
+			if (write_all(fd, &image[sent], len)) {
+				fprintf(stderr, "\nWrite failed\n");
+				return 1;
+			}
+			sent += len;
+		}
+
+		/* Older firmware follows each string with a NUL */
+		do {
+			c = read_char(fd);
+		} while (c == '\0');
+		if (c != 'k') {
+			fprintf(stderr, "\nTransfer failed at %zu bytes\n", acked);
+			return 1;
+		}
+		acked += CHUNK_SIZE;
+		if (acked > size)
+			acked = size;
+		printf("\r%zu/%zu", acked, size);
+		fflush(stdout);
+	}
+
+	if (wait_for(fd, "\nOK\r\n")) {
+		fprintf(stderr, "\nClock rejected the image\n");
+		return 1;
+	}
+	printf("\nDone. Clock is rebooting\n");
+
+	close(fd);
+	free(image);
+	return 0;
+}
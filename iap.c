@@ -2,10 +2,6 @@
 
 #include "iap.h"
 
-#define IAP_LOCATION 0x1fff1ff1
-
-typedef void (* const IAP)(uint32_t *command, uint32_t *result);
-
 IAP iap_entry = (IAP)IAP_LOCATION;
 
 uint32_t iap_buf[6];
@@ -53,3 +49,51 @@ int iap_eeprom_read(uint32_t eeprom_addr, void *data, uint32_t len)
 
 	return (int)iap_buf[0];
 }
+
+int iap_prepare_sectors(uint32_t start, uint32_t end)
+{
+	iap_buf[0] = 50;
+	iap_buf[1] = start;
+	iap_buf[2] = end;
+
+	iap_entry(iap_buf, iap_buf);
+
+	return (int)iap_buf[0];
+}
+
+int iap_copy_ram_to_flash(uint32_t flash_addr, void *data, uint32_t len)
+{
+	iap_buf[0] = 51;
+	iap_buf[1] = flash_addr;
+	iap_buf[2] = (uint32_t)((uintptr_t)data);
+	iap_buf[3] = len;
+	iap_buf[4] = SystemCoreClock / 1000;
+
+	iap_entry(iap_buf, iap_buf);
+
+	return (int)iap_buf[0];
+}
+
+int iap_erase_sectors(uint32_t start, uint32_t end)
+{
+	iap_buf[0] = 52;
+	iap_buf[1] = start;
+	iap_buf[2] = end;
+	iap_buf[3] = SystemCoreClock / 1000;
+
+	iap_entry(iap_buf, iap_buf);
+
+	return (int)iap_buf[0];
+}
+
+int iap_compare(uint32_t flash_addr, void *data, uint32_t len)
+{
+	iap_buf[0] = 56;
+	iap_buf[1] = flash_addr;
+	iap_buf[2] = (uint32_t)((uintptr_t)data);
+	iap_buf[3] = len;
+
+	iap_entry(iap_buf, iap_buf);
+
+	return (int)iap_buf[0];
+}
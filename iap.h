@@ -23,10 +23,28 @@
 #define INVALID_STOP_BIT    18
 #define CODE_READ_PROTECTION_ENABLED 19
 
+#define IAP_LOCATION 0x1fff1ff1
+
+typedef void (* const IAP)(uint32_t *command, uint32_t *result);
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE   256
+
 int iap_read_partid(uint32_t **result);
 int iap_read_uid(uint32_t **result);
 
 int iap_eeprom_write(uint32_t eeprom_addr, void *data, uint32_t len);
 int iap_eeprom_read(uint32_t eeprom_addr, void *data, uint32_t len);
 
+/*
+ * Flash programming. Interrupts must be disabled by the caller while
+ * these run, because the flash can't be read during an erase/write.
+ * 'data' must be word-aligned and in RAM. 'len' must be 256, 512, 1024
+ * or 4096.
+ */
+int iap_prepare_sectors(uint32_t start, uint32_t end);
+int iap_copy_ram_to_flash(uint32_t flash_addr, void *data, uint32_t len);
+int iap_erase_sectors(uint32_t start, uint32_t end);
+int iap_compare(uint32_t flash_addr, void *data, uint32_t len);
+
 #endif /* __IAP_H__ */
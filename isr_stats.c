@@ -0,0 +1,65 @@
+/*
+ * Interrupt handler timing
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "LPC11Uxx.h"
+
+#include "isr_stats.h"
+#include "util.h"
+
+const char *const isr_names[ISR_N_IDS] = {
+	[ISR_BCM]    = "BCM",
+	[ISR_ANIM]   = "ANIM",
+	[ISR_USB]    = "USB",
+	[ISR_BUTTON] = "BUTTON",
+	[ISR_SSP]    = "SSP",
+	[ISR_ADC]    = "ADC",
+};
+
+static struct isr_stat isr_stats[ISR_N_IDS];
+
+RAMFUNC void isr_stats_record(enum isr_id id, uint32_t start)
+{
+	struct isr_stat *stat = &isr_stats[id];
+	uint32_t end = SysTick->VAL;
+	uint32_t cycles, tmp;
+	int bucket = 0;
+
+	/* SysTick counts down, and reloads at zero */
+	if (end > start)
+		start += SysTick->LOAD + 1;
+	cycles = start - end;
+
+	/* Handlers can nest, so be atomic */
+	__disable_irq();
+	stat->count++;
+	stat->total += cycles;
+	if (!stat->min || cycles < stat->min)
+		stat->min = cycles;
+	if (cycles > stat->max)
+		stat->max = cycles;
+
+	tmp = cycles >> 4;
+	while (tmp && bucket < ISR_STATS_BUCKETS - 1) {
+		tmp >>= 1;
+		bucket++;
+	}
+	stat->hist[bucket]++;
+	__enable_irq();
+}
+
+void isr_stats_get(enum isr_id id, struct isr_stat *stat)
+{
+	__disable_irq();
+	*stat = isr_stats[id];
+	__enable_irq();
+}
+
+void isr_stats_reset(void)
+{
+	__disable_irq();
+	memset(isr_stats, 0, sizeof(isr_stats));
+	__enable_irq();
+}
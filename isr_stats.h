@@ -0,0 +1,61 @@
+/*
+ * Interrupt handler timing
+ *
+ * Handlers wrap their body in ISR_STATS_ENTER()/ISR_STATS_EXIT(), which
+ * sample SysTick on the way in and out. Times are in core clock cycles,
+ * so handlers must take less than one SysTick period (1 ms).
+ * Build with ISR_STATS defined (make STATS=1) to enable. Otherwise the
+ * macros are empty.
+ */
+#ifndef __ISR_STATS_H__
+#define __ISR_STATS_H__
+#include <stdint.h>
+
+#include "LPC11Uxx.h"
+
+enum isr_id {
+	ISR_BCM,
+	ISR_ANIM,
+	ISR_USB,
+	ISR_BUTTON,
+	ISR_SSP,
+	ISR_ADC,
+	ISR_N_IDS,
+};
+
+/*
+ * Bucket 0 counts times under 16 cycles, bucket n from (16 << (n - 1)) up
+ * to (16 << n), and the last bucket everything longer
+ */
+#define ISR_STATS_BUCKETS 8
+
+struct isr_stat {
+	uint32_t count;
+	uint64_t total;
+	uint32_t min;
+	uint32_t max;
+	uint32_t hist[ISR_STATS_BUCKETS];
+};
+
+#ifdef ISR_STATS
+
+extern const char *const isr_names[ISR_N_IDS];
+
+#define ISR_STATS_ENTER() uint32_t __isr_stats_start = SysTick->VAL
+#define ISR_STATS_EXIT(_id) isr_stats_record((_id), __isr_stats_start)
+
+void isr_stats_record(enum isr_id id, uint32_t start);
+
+/* Take a consistent copy of one handler's stats */
+void isr_stats_get(enum isr_id id, struct isr_stat *stat);
+
+void isr_stats_reset(void);
+
+#else
+
+#define ISR_STATS_ENTER() do { } while (0)
+#define ISR_STATS_EXIT(_id) do { } while (0)
+
+#endif /* ISR_STATS */
+
+#endif /* __ISR_STATS_H__ */
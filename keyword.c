@@ -0,0 +1,59 @@
+/*
+ * Keyword lookup for the command tables
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "keyword.h"
+
+static const char *entry_name(const struct keyword_index *idx, size_t i)
+{
+	return *(const char *const *)((const char *)idx->table + (i * idx->stride));
+}
+
+unsigned int keyword_hash(const char *name)
+{
+	uint32_t h = 0;
+
+	while (*name)
+		h = (h * 31) + (uint8_t)*name++;
+
+	return h & (KEYWORD_SLOTS - 1);
+}
+
+static void keyword_build(struct keyword_index *idx)
+{
+	unsigned int h;
+	size_t i;
+
+	memset(idx->slot, 0, sizeof(idx->slot));
+
+	/* Leave at least one slot empty, so a miss always ends */
+	for (i = 0; (i < idx->n) && (i < KEYWORD_SLOTS - 1); i++) {
+		h = keyword_hash(entry_name(idx, i));
+		while (idx->slot[h])
+			h = (h + 1) & (KEYWORD_SLOTS - 1);
+		idx->slot[h] = i + 1;
+	}
+
+	idx->built = true;
+}
+
+int keyword_find(struct keyword_index *idx, const char *name)
+{
+	unsigned int h;
+	int i;
+
+	if (!idx->built)
+		keyword_build(idx);
+
+	for (h = keyword_hash(name); idx->slot[h]; h = (h + 1) & (KEYWORD_SLOTS - 1)) {
+		i = idx->slot[h] - 1;
+		if (!strcmp(name, entry_name(idx, i)))
+			return i;
+	}
+
+	return -1;
+}
@@ -0,0 +1,40 @@
+/*
+ * Keyword lookup for the command tables
+ *
+ * Each table is an array of structs with the keyword ("const char *name")
+ * as the first member. The first lookup hashes every keyword into a small
+ * open-addressed index, and after that finding one costs a hash of the
+ * token and (almost always) a single strcmp(), however long the table.
+ */
+#ifndef __KEYWORD_H__
+#define __KEYWORD_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Must be a power of two, and more than the entries in any table */
+#define KEYWORD_SLOTS 32
+
+struct keyword_index {
+	const void *table;
+	size_t n;
+	size_t stride;
+	bool built;
+	/* Entry number + 1 for each slot, 0 if empty */
+	uint8_t slot[KEYWORD_SLOTS];
+};
+
+/* Static initialiser for an index of the array '_table' */
+#define KEYWORD_INDEX(_table) {                            \
+	.table = (_table),                                 \
+	.n = sizeof(_table) / sizeof((_table)[0]),         \
+	.stride = sizeof((_table)[0]),                     \
+}
+
+/* Slot a keyword hashes to, before probing */
+unsigned int keyword_hash(const char *name);
+
+/* Returns the index in the table of 'name', or -1 if it isn't there */
+int keyword_find(struct keyword_index *idx, const char *name);
+
+#endif /* __KEYWORD_H__ */
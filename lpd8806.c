@@ -29,10 +29,35 @@ void lpd8806_reset(struct spi_dev *dev, int n_leds)
 	}
 }
 
-void lpd8806_update(struct spi_dev *dev, uint32_t *colors, int n_leds)
+int lpd8806_pack(uint8_t *frame, const uint32_t *colors, int n_leds)
 {
-	int n = n_leds;
+	uint8_t *p = frame;
+	int n = LPD8806_LATCH_BYTES(n_leds);
+
+	/* Same byte order as send_color() */
+	while (n_leds--) {
+		uint32_t color = *colors++;
+		*p++ = color | 0x80;
+		*p++ = (color >> 8) | 0x80;
+		*p++ = (color >> 16) | 0x80;
+	}
+
 	while (n--)
-		send_color(dev, *colors++);
-	lpd8806_reset(dev, n_leds);
+		*p++ = 0;
+
+	return p - frame;
+}
+
+void lpd8806_send(struct spi_dev *dev, const uint8_t *frame, int len)
+{
+	spi_wait(dev);
+	spi_transfer_async(dev, frame, NULL, len, NULL, NULL);
+}
+
+void lpd8806_update(struct spi_dev *dev, uint8_t *frame, const uint32_t *colors,
+		int n_leds)
+{
+	/* Don't touch the frame until the last one has gone */
+	spi_wait(dev);
+	lpd8806_send(dev, frame, lpd8806_pack(frame, colors, n_leds));
 }
@@ -70,12 +70,39 @@ void lpd8806_init(struct spi_dev *dev, int n_leds);
 /* Send reset/latch "zero" bytes - one for every 32 LEDs */
 void lpd8806_reset(struct spi_dev *dev, int n_leds);
 
-/* Update a strip with RGB values
+/* Number of "zero" bytes needed to latch/reset a strip */
+#define LPD8806_LATCH_BYTES(_n_leds) (((_n_leds) + 31) / 32)
+
+/* Size of a packed frame, including the latch bytes */
+#define LPD8806_FRAME_SIZE(_n_leds) (((_n_leds) * 3) + LPD8806_LATCH_BYTES(_n_leds))
+
+/* Pack RGB values into a wire-format frame
  *
  * Each pixel is stored in a 32-bit word, with the colour data in the
  * lowest 24 bits. Each component should be 7 bits.
  *  0x00GGRRBB
+ * 'frame' must have room for LPD8806_FRAME_SIZE(n_leds) bytes. The high bit
+ * of every colour byte is set, and the latch bytes are appended.
+ * Returns the number of bytes written.
+ */
+int lpd8806_pack(uint8_t *frame, const uint32_t *colors, int n_leds);
+
+/* Stream a packed frame to the strip
+ *
+ * The whole frame is sent as a single background SPI transfer, so this
+ * returns immediately. 'frame' must not be modified until spi_busy()
+ * returns false.
+ */
+void lpd8806_send(struct spi_dev *dev, const uint8_t *frame, int len);
+
+/* Update a strip with RGB values
+ *
+ * Packs 'colors' into 'frame' (see lpd8806_pack()) and sends it with
+ * lpd8806_send().
+ * 'n_leds' can be less than the length of the strip, to only update the
+ * first n_leds LEDs. The rest keep their old colours.
  */
-void lpd8806_update(struct spi_dev *dev, uint32_t *colors, int n_leds);
+void lpd8806_update(struct spi_dev *dev, uint8_t *frame, const uint32_t *colors,
+		int n_leds);
 
 #endif /* __LPD8806_H__ */
@@ -1,6 +1,9 @@
 /*
  * LPD8806 segment display implementation
  *
+ * Also drives WS2812 strips, when built with DISPLAY_WS2812 - only the
+ * wire format differs.
+ *
  * Copyright Brian Starkey 2015 <stark3y@gmail.com>
  *
  * Permission is hereby granted, free of charge, to any person obtaining a copy
@@ -21,19 +24,82 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
+#include "LPC11Uxx.h"
+
+#include "isr_stats.h"
 #include "lpd8806.h"
+#include "ws2812.h"
 #include "spi.h"
 #include "segment_display.h"
 #include "util.h"
 
 #define N_LEDS 26
 #define N_SEGMENTS 8
-#define FADE_STEP 2
+
+/* The strip is happy well above this, but the wires to it are long */
+#define LPD8806_SPI_RATE 4000000
+
+/* Animation timer rate, kept the same whatever the core clock is */
+#define ANIM_TICK_HZ 2000
+
+/* Animation tick period in ANIM_TICK_HZ ticks, 10 ms, or 40 ms at night */
+#define ANIM_PERIOD       20
+#define NIGHT_ANIM_PERIOD 80
+
+/*
+ * With two strips, the LEDs are split evenly between them. The first half
+ * is on SSP0 (MOSI on PIO0_9, SCK on PIO0_10) and the second on SSP1 (MOSI
+ * on PIO0_21, SCK on PIO1_15). Both are sent at the same time.
+ */
+#ifndef LPD8806_N_STRIPS
+#define LPD8806_N_STRIPS 1
+#endif
+#define STRIP_LEDS ((N_LEDS + LPD8806_N_STRIPS - 1) / LPD8806_N_STRIPS)
+
+#ifdef DISPLAY_WS2812
+#define STRIP_FRAMESZ FRAMESZ_12BIT
+#define STRIP_FRAME_SIZE(_n_leds) WS2812_FRAME_SIZE(_n_leds)
+#define strip_update ws2812_update
+typedef uint16_t strip_word;
+
+static void strip_init(struct spi_dev *spi, int n_leds)
+{
+	(void)n_leds;
+	ws2812_init(spi);
+}
+#else
+#define STRIP_FRAMESZ FRAMESZ_8BIT
+#define STRIP_FRAME_SIZE(_n_leds) LPD8806_FRAME_SIZE(_n_leds)
+#define strip_update lpd8806_update
+typedef uint8_t strip_word;
+
+static void strip_init(struct spi_dev *spi, int n_leds)
+{
+	spi_set_rate(spi, LPD8806_SPI_RATE);
+	lpd8806_init(spi, n_leds);
+}
+#endif
 
 extern uint32_t hsvtorgb(unsigned char h, unsigned char s, unsigned char v);
 
 uint32_t framebuffer[N_LEDS] = { 0 };
 
+struct lpd8806_strip {
+	struct spi_dev *spi;
+	/* First LED in the framebuffer, and number of LEDs */
+	int start;
+	int len;
+	/*
+	 * framebuffer has changes which haven't been sent yet, all before
+	 * LED dirty_end (relative to 'start'). The strip latches from the
+	 * first LED onwards, so only the LEDs up to there need to be sent.
+	 */
+	int dirty_end;
+	strip_word wire_frame[STRIP_FRAME_SIZE(STRIP_LEDS)];
+};
+
+struct lpd8806_strip strips[LPD8806_N_STRIPS];
+
 struct lpd8806_segment {
 	int start;
 	int len;
@@ -51,59 +117,281 @@ struct lpd8806_segment segments[N_SEGMENTS] = {
 };
 
 struct segment_display {
-	struct spi_dev *spi;
+	struct lpd8806_strip *strips;
 	struct lpd8806_segment *segments;
+	/* 7-bit level of each segment */
+	uint8_t level[N_SEGMENTS];
+	uint8_t start[N_SEGMENTS];
+	uint8_t target[N_SEGMENTS];
+	/* Master brightness, slewing from 'master' to 'master_target' */
+	uint16_t master;
+	uint16_t master_target;
+	/* Master change per tick, which depends on the tick period */
+	uint16_t master_step;
+	/* Per-segment colour (0xRRGGBB) and relative brightness */
+	uint32_t color[N_SEGMENTS];
+	uint16_t brightness[N_SEGMENTS];
+	/* Segments whose colour changed, and need re-rendering */
+	segment_mask redraw;
+	uint32_t anim_start;
 } lpd8806_display;
 
-typedef uint32_t segment_mask;
+const uint32_t anim_length = 1024;
+
+/* Full scale in DISPLAY_BRIGHTNESS_RAMP_MS, at one step per tick */
+#define MASTER_STEP(_period) \
+	((0xffff * (_period)) / ((DISPLAY_BRIGHTNESS_RAMP_MS * ANIM_TICK_HZ) / 1000))
+
+/* No refresh interrupt - the strip holds its own state */
+volatile uint32_t bcm_isr_count;
+volatile uint32_t anim_isr_count;
+
+/* Colour for each 7-bit level, so fades don't need hsvtorgb() */
+uint32_t palette[0x80];
+
+static void build_palette(void)
+{
+	int i;
+
+	for (i = 0; i < 0x80; i++)
+		palette[i] = hsvtorgb(i, 0xff, i);
+}
+
+/* Work out the strip colour (0x00GGRRBB) for segment 'i' at 'level' */
+static uint32_t segment_color(struct segment_display *disp, int i,
+		uint8_t level)
+{
+	uint32_t rgb = disp->color[i];
+	uint32_t r, g, b;
+
+	level = (level * disp->master) >> 16;
+
+	if (rgb == DISPLAY_COLOR_DEFAULT)
+		return palette[level];
+
+	/* 8-bit components scaled by the 7-bit level give 7-bit output */
+	r = (((rgb >> 16) & 0xff) * level) >> 8;
+	g = (((rgb >> 8) & 0xff) * level) >> 8;
+	b = ((rgb & 0xff) * level) >> 8;
+
+	return (g << 16) | (r << 8) | b;
+}
 
 void lpd8806_set_segment(struct segment_display *disp,
-						 struct lpd8806_segment *segment,
-						 uint32_t value)
+		struct lpd8806_segment *segment, uint32_t color)
 {
+	uint32_t *p = &framebuffer[segment->start];
+	int end = segment->start + segment->len;
 	int nleds = segment->len;
-	while (nleds--) {
-		framebuffer[segment->start + nleds] =
-				hsvtorgb(value, 0xff, value);
+	int i;
+
+	for (i = 0; i < LPD8806_N_STRIPS; i++) {
+		struct lpd8806_strip *strip = &disp->strips[i];
+		int strip_end = end - strip->start;
+
+		/* Only strips the segment actually touches need sending */
+		if ((strip_end <= 0) ||
+		    (segment->start >= strip->start + strip->len))
+			continue;
+		if (strip_end > strip->len)
+			strip_end = strip->len;
+		if (strip_end > strip->dirty_end)
+			strip->dirty_end = strip_end;
 	}
+
+	while (nleds--)
+		*p++ = color;
 }
 
-struct segment_display *display_init(struct spi_dev *spi)
+// TIMER_32_0 drives the animations, ticking every 10ms
+static void init_timer32()
 {
-	lpd8806_display.spi = spi;
+	LPC_CTxxBx_Type *timer = LPC_CT32B0;
+
+	NVIC_SetPriority(TIMER_32_0_IRQn, 3);
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+
+	/* Turn on the clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 9);
+
+	timer->PR = (SystemCoreClock / ANIM_TICK_HZ) - 1;
+
+	/* 10 ms overflow */
+	timer->MR3 = ANIM_PERIOD;
+	timer->MCR = (1 << 9) | (1 << 10);
+	timer->TCR = 0x1;
+}
+
+void TIMER_32_0_Handler(void)
+{
+	ISR_STATS_ENTER();
+	struct segment_display *disp = &lpd8806_display;
+	uint32_t status = LPC_CT32B0->IR;
+	anim_isr_count++;
+	if (status & (1 << 3)) {
+		uint32_t tmp = ms_since(disp->anim_start);
+		int i;
+
+		if (disp->master != disp->master_target) {
+			disp->master = slew(disp->master, disp->master_target,
+					disp->master_step);
+			disp->redraw = (1 << N_SEGMENTS) - 1;
+		}
+
+		/* Only re-render the segments which are moving */
+		for (i = 0; i < N_SEGMENTS; i++) {
+			if (disp->level[i] != disp->target[i]) {
+				disp->level[i] = lerp(disp->start[i], disp->target[i],
+						tmp, anim_length);
+			} else if (!(disp->redraw & (1 << i))) {
+				continue;
+			}
+
+			lpd8806_set_segment(disp, &disp->segments[i],
+					segment_color(disp, i, disp->level[i]));
+		}
+		disp->redraw = 0;
+
+		/*
+		 * The strips are sent in parallel, each from its own SSP
+		 * interrupt. If the last frame on a strip is still going out,
+		 * try again next tick rather than waiting for it.
+		 */
+		for (i = 0; i < LPD8806_N_STRIPS; i++) {
+			struct lpd8806_strip *strip = &disp->strips[i];
+
+			if (strip->dirty_end && !spi_busy(strip->spi)) {
+				strip_update(strip->spi, strip->wire_frame,
+						&framebuffer[strip->start],
+						strip->dirty_end);
+				strip->dirty_end = 0;
+			}
+		}
+	}
+	LPC_CT32B0->IR = status;
+	ISR_STATS_EXIT(ISR_ANIM);
+}
+
+struct segment_display *display_init(void)
+{
+	int i;
+
+	for (i = 0; i < LPD8806_N_STRIPS; i++) {
+		struct lpd8806_strip *strip = &strips[i];
+
+		strip->spi = spi_init(i ? SSP1 : SSP0, STRIP_FRAMESZ);
+		strip->start = i * STRIP_LEDS;
+		strip->len = N_LEDS - strip->start;
+		if (strip->len > STRIP_LEDS)
+			strip->len = STRIP_LEDS;
+
+		strip_init(strip->spi, strip->len);
+
+		/* Start with everything off */
+		strip_update(strip->spi, strip->wire_frame,
+				&framebuffer[strip->start], strip->len);
+	}
+
+	lpd8806_display.strips = strips;
 	lpd8806_display.segments = segments;
+	lpd8806_display.master = 0xffff;
+	lpd8806_display.master_target = 0xffff;
+	lpd8806_display.master_step = MASTER_STEP(ANIM_PERIOD);
+	for (i = 0; i < N_SEGMENTS; i++) {
+		lpd8806_display.color[i] = DISPLAY_COLOR_DEFAULT;
+		lpd8806_display.brightness[i] = 0xffff;
+	}
+	build_palette();
+
+	init_timer32();
+
 	return &lpd8806_display;
 }
 
+void display_clock_changed(struct segment_display *disp)
+{
+	int i;
+
+	/* Clear the prescale counter, in case it's past the new PR */
+	LPC_CT32B0->PR = (SystemCoreClock / ANIM_TICK_HZ) - 1;
+	LPC_CT32B0->PC = 0;
+
+	/*
+	 * spi_set_rate() waits for any frame which is still going out. Hold
+	 * off the tick so it doesn't start another one.
+	 */
+	NVIC_DisableIRQ(TIMER_32_0_IRQn);
+	for (i = 0; i < LPD8806_N_STRIPS; i++)
+		spi_set_rate(disp->strips[i].spi,
+				spi_get_rate(disp->strips[i].spi));
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+}
+
+bool display_clock_ok(struct segment_display *disp, enum clock_speed speed)
+{
+	(void)disp;
+
+#ifdef DISPLAY_WS2812
+	/* The bit timings are only right at exactly WS2812_SPI_RATE */
+	return ws2812_rate_ok(clock_main_hz(speed));
+#else
+	/* The LPD8806 is fine with a slower clock */
+	(void)speed;
+	return true;
+#endif
+}
+
+void display_set_night(struct segment_display *disp, bool night)
+{
+	disp->master_step = MASTER_STEP(night ? NIGHT_ANIM_PERIOD : ANIM_PERIOD);
+
+	/* Clear the counter too, in case it's past the new MR3 */
+	LPC_CT32B0->MR3 = night ? NIGHT_ANIM_PERIOD : ANIM_PERIOD;
+	LPC_CT32B0->TC = 0;
+}
+
+void display_set_brightness(struct segment_display *disp, uint16_t brightness)
+{
+	disp->master_target = brightness;
+}
+
+void display_set_color(struct segment_display *disp, int segment,
+		uint32_t rgb, uint16_t brightness)
+{
+	NVIC_DisableIRQ(TIMER_32_0_IRQn);
+	disp->color[segment] = rgb;
+	disp->brightness[segment] = brightness;
+	disp->redraw |= (1 << segment);
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+}
+
 void display_transition(struct segment_display *disp,
 		segment_mask from, segment_mask to)
 {
-	uint32_t bring_in = to & ~from;
-	uint32_t fade_out = from & ~to;
-	uint32_t in_val = 0;
-	uint32_t out_val = 0x7f;
 	int i;
+	(void)from;
 
-	for (in_val = 0; in_val <= 0x7f; in_val += FADE_STEP,
-	                                 out_val -= FADE_STEP) {
-		for (i = 0; i < N_SEGMENTS; i++) {
-			if (bring_in & (1 << i)) {
-				lpd8806_set_segment(disp, &disp->segments[i], in_val);
-			}
-			if (fade_out & (1 << i)) {
-				lpd8806_set_segment(disp, &disp->segments[i], out_val);
-			}
+	NVIC_DisableIRQ(TIMER_32_0_IRQn);
+	for (i = 0; i < N_SEGMENTS; i++) {
+		disp->start[i] = disp->level[i];
+		if (to & (1 << i)) {
+			disp->target[i] = (0x7f *
+					(disp->brightness[i] + 1)) >> 16;
+		} else {
+			disp->target[i] = 0;
 		}
-		lpd8806_update(disp->spi, framebuffer, N_LEDS);
-		delay_ms(16);
 	}
+	disp->anim_start = msTicks;
+	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+}
+
+void display_get_levels(struct segment_display *disp, uint16_t *level,
+		uint16_t *target)
+{
+	int i;
+
 	for (i = 0; i < N_SEGMENTS; i++) {
-		if (bring_in & (1 << i)) {
-			lpd8806_set_segment(disp, &disp->segments[i], 0x7f);
-		}
-		if (fade_out & (1 << i)) {
-			lpd8806_set_segment(disp, &disp->segments[i], 0);
-		}
+		level[i] = disp->level[i] << 9;
+		target[i] = disp->target[i] << 9;
 	}
-	lpd8806_update(disp->spi, framebuffer, N_LEDS);
 }
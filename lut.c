@@ -37,7 +37,7 @@ const uint32_t lut[32] = {
 	LUT_COEFF(60382, 2.51611328125),
 };
 
-uint16_t lut1d(uint16_t x)
+RAMFUNC uint16_t lut1d(uint16_t x)
 {
 	int node = x / 2048;
 	uint32_t coeff = lut[node];
@@ -2,5 +2,7 @@
 #define __LUT_H__
 #include <stdint.h>
 
-uint16_t lut1d(uint16_t x);
+#include "util.h"
+
+RAMFUNC uint16_t lut1d(uint16_t x);
 #endif /* __LUT_H__ */
@@ -4,47 +4,28 @@
 
 #include "LPC11Uxx.h"
 
+#include "ambient.h"
+#include "button.h"
+#include "clock.h"
 #include "iap.h"
+#include "isr_stats.h"
+#include "keyword.h"
+#include "profile.h"
 #include "ds1302.h"
-#include "lut.h"
+#include "segment_display.h"
+#include "updater.h"
 #include "usb_cdc.h"
 #include "util.h"
 
-#define PIN_LED0 (1 << 15)
-#define PIN_LED1 (1 << 14)
-#define PIN_LED2 (1 << 13)
-#define PIN_LED3 (1 << 12)
-#define PIN_LED4 (1 << 11)
-#define PIN_LED5 (1 << 10)
-#define PIN_LED6 (1 <<  9)
-#define PIN_LED7 (1 <<  8)
-#define N_CHANNELS  8
-
-//#define DEBUG
-#ifdef DEBUG
-#define DBG_PORT (0)
-#define DBG_PIN  (1 << 19)
-#define DBG_PIN1  (1 << 18)
-#define DBG_HIGH()   LPC_GPIO->SET[DBG_PORT] = DBG_PIN
-#define DBG_LOW()    LPC_GPIO->CLR[DBG_PORT] = DBG_PIN
-#define DBG_TOGGLE() LPC_GPIO->NOT[DBG_PORT] = DBG_PIN
-#else
-#define DBG_HIGH() {}
-#define DBG_LOW()  {}
-#define DBG_TOGGLE() {}
-#endif
-
-#define PWM_CHANNELS   8
-#define PWM_RESOLUTION 10
-#define MIN_CYCLES_LOG2 2
-
 #define N_MEALS   5
 #define N_TIMES   8
 
 #define EEPROM_TIME_OFFSET 4
 #define EEPROM_BRIGHTNESS_OFFSET (EEPROM_TIME_OFFSET + (N_TIMES * 2))
+#define EEPROM_AMBIENT_OFFSET (EEPROM_BRIGHTNESS_OFFSET + 2)
+#define EEPROM_NIGHT_OFFSET (EEPROM_AMBIENT_OFFSET + 2)
 
-#define EEPROM_VERSION 1 // Increment this every time the EEPROM layout changes
+#define EEPROM_VERSION 3 // Increment this every time the EEPROM layout changes
 #define EEPROM_MAGIC (((uint32_t)(('f' << 24) | ('u' << 16) | ('z' << 8) | ('z' << 0))) + EEPROM_VERSION)
 
 #define BREAKFAST   0
@@ -59,16 +40,8 @@
 #define ITS_TIME    7
 #define BIT(x)      (1 << (x))
 
-const uint8_t channel_map[] = {
-	LUNCH,
-	DINNER,
-	BED,
-	NEARLY,
-	PAST,
-	HOME,
-	BREAKFAST,
-	ITS_TIME,
-};
+/* How long to show each sentence for in demo mode */
+#define DEMO_PERIOD 2560
 
 const uint8_t sequence[] = {
 	(0),
@@ -116,6 +89,12 @@ struct timeband {
 int n_timebands = 0;
 struct timeband timebands[20];
 uint16_t brightness = 0xffff;
+/* Non-zero to scale the brightness with the ambient light level */
+uint16_t ambient = 0;
+/* Brightness at night, or 0 to turn off */
+uint16_t night_brightness = 0;
+
+struct segment_display *disp;
 
 uint8_t hours(uint16_t time)
 {
@@ -207,149 +186,106 @@ void build_timebands()
 	n_timebands++;
 }
 
-enum button_state {
-	NONE,
-	PRESSED,
-	HELD,
-};
-volatile enum button_state button = NONE;
-enum clock_mode {
-	NORMAL,
-	BLANKED,
-	DEMO,
-};
-volatile enum clock_mode mode = NORMAL;
-volatile bool dirty = false;
-
-volatile uint32_t bitslices[2][PWM_RESOLUTION];
-volatile uint8_t in_use_set = 0;
-volatile uint8_t queued_set = 0;
-volatile uint16_t values[PWM_CHANNELS];
-
-void TIMER_16_0_Handler(void) {
-	static int bit = 0;
-	static int dir = 1;
-	static uint32_t period = (1 << MIN_CYCLES_LOG2);
-	static volatile uint32_t *set = bitslices[0];
-
-	DBG_HIGH();
-	LPC_CTxxBx_Type *timer = LPC_CT16B0;
-	uint32_t status = timer->IR;
-
-	if (status & (1 << 3)) {
-		/*
-		 * Fun fact: You can't use reset-on-match mode and change the
-		 * match value in the interrupt handler.
-		 * The reset happens 1 prescaled clock cycle after the match
-		 * interrupt, which means if you change the match here, the
-		 * reset for the old match doesn't happen.
-		 * You can spin waiting for the reset before changing the MR,
-		 * but that blows my timing budget:
-		 *     while (timer->MR3 >= period - 1);
-		 * Instead, we clear the counter manually. It will introduce
-		 * some jitter, but ultimately is probably fine.
-		 */
-		timer->TC = 0;
-		timer->MR3 = period - 1;
-
-		LPC_GPIO->MPIN[0] = set[bit];
-		bit += dir;
+int find_band(uint16_t time)
+{
+	int i, band = 0;
 
-#ifdef DEBUG
-		LPC_GPIO->NOT[DBG_PORT] = DBG_PIN1;
-#endif
-		if (dir > 0 && bit == PWM_RESOLUTION) {
-			in_use_set = queued_set;
-			set = bitslices[in_use_set];
-			bit = PWM_RESOLUTION - 1;
-			dir = -1;
-		} else if (dir < 0 && bit == -1) {
-			in_use_set = queued_set;
-			set = bitslices[in_use_set];
-			bit = 0;
-			dir = 1;
+	for (i = 0; i < n_timebands; i++) {
+		if (time >= timebands[i].start) {
+			band = i;
 		}
-		period = 1 << (MIN_CYCLES_LOG2 + bit);
 	}
-	timer->IR = status;
-	DBG_LOW();
+
+	return band;
 }
 
-static void init_timer16(void)
+/*
+ * Read the times and brightness from EEPROM. Returns false, leaving the
+ * defaults, if the EEPROM doesn't have valid settings.
+ */
+bool load_settings(void)
 {
-	LPC_CTxxBx_Type *timer = LPC_CT16B0;
-
-	NVIC_SetPriority(TIMER_16_0_IRQn, 0);
-	NVIC_EnableIRQ(TIMER_16_0_IRQn);
+	uint32_t magic = 0;
+	int ret;
 
-	/* Turn on the clock - 48MHz */
-	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 7);
+	ret = iap_eeprom_read(0, &magic, 4);
+	if ((ret != 0) || (magic != EEPROM_MAGIC)) {
+		return false;
+	}
 
-	/* Conservative */
-	//timer->PR = 80;
-	timer->PR = 60;
+	/* The times are contiguous, so read them in one go */
+	ret = iap_eeprom_read(EEPROM_TIME_OFFSET, times, N_TIMES * 2);
+	if (ret != 0) {
+		return false;
+	}
+	iap_eeprom_read(EEPROM_BRIGHTNESS_OFFSET, &brightness, 2);
+	iap_eeprom_read(EEPROM_AMBIENT_OFFSET, &ambient, 2);
+	iap_eeprom_read(EEPROM_NIGHT_OFFSET, &night_brightness, 2);
 
-	/* Use MR3 as overflow interupt */
-	timer->MR3 = 0;
-	timer->MCR = (1 << 9);
-	timer->TCR = 0x1;
+	return true;
 }
 
-void pwm_flip() {
-	int i;
-	uint16_t mask = 1 << (16 - PWM_RESOLUTION);
+/* Store the defaults to EEPROM */
+void store_settings(void)
+{
+	uint32_t magic = EEPROM_MAGIC;
+	int ret;
 
-	/*
-	 * If previous flip hasn't completed, we try to cancel it.
-	 * The timer routing will race with us, but all possibilities are
-	 * fine:
-	 *  - If the timer already swapped, then the condition is false and we're fine
-	 *  - If the timer swaps in between the check and the set, then queued_set
-	 *    simply doesn't change
-	 *  - If both the check and set happen before the timer swaps, then the
-	 *    previous flip is cancelled
-	 */
-	if (queued_set != in_use_set) {
-		NVIC_DisableIRQ(TIMER_16_0_IRQn);
-		queued_set = in_use_set;
-		NVIC_EnableIRQ(TIMER_16_0_IRQn);
-	}
-
-	volatile uint32_t *slice = bitslices[!queued_set];
-	for (i = 0; i < PWM_RESOLUTION; i++, mask <<= 1) {
-		slice[i] = (
-			   ((values[0] & mask) ? PIN_LED0 : 0) |
-			   ((values[1] & mask) ? PIN_LED1 : 0) |
-			   ((values[2] & mask) ? PIN_LED2 : 0) |
-			   ((values[3] & mask) ? PIN_LED3 : 0) |
-			   ((values[4] & mask) ? PIN_LED4 : 0) |
-			   ((values[5] & mask) ? PIN_LED5 : 0) |
-			   ((values[6] & mask) ? PIN_LED6 : 0) |
-			   ((values[7] & mask) ? PIN_LED7 : 0)
-		);
-	}
-	queued_set = !queued_set;
+	ret = iap_eeprom_write(EEPROM_TIME_OFFSET, times, N_TIMES * 2);
+	if (ret != 0) {
+		return;
+	}
+	ret = iap_eeprom_write(EEPROM_BRIGHTNESS_OFFSET, &brightness, 2);
+	if (ret != 0) {
+		return;
+	}
+	ret = iap_eeprom_write(EEPROM_AMBIENT_OFFSET, &ambient, 2);
+	if (ret != 0) {
+		return;
+	}
+	ret = iap_eeprom_write(EEPROM_NIGHT_OFFSET, &night_brightness, 2);
+	if (ret == 0) {
+		iap_eeprom_write(0, &magic, 4);
+	}
 }
 
-void pwm_set(uint8_t channel, uint16_t value) {
-	values[channel] = lut1d(value);
-}
+/*
+ * Boot timestamps, in cycles since SysTick was started (so not counting
+ * SystemInit()). Read with the BOOT command.
+ */
+enum boot_phase {
+	BOOT_MAIN,
+	BOOT_DISPLAY,
+	BOOT_SETTINGS,
+	BOOT_FIRST_FRAME,
+	BOOT_USB,
+	BOOT_DONE,
+	BOOT_N_PHASES,
+};
 
-void leds_init(void)
-{
-	/* Set all our LED pins as GPIO outputs */
-	set_with_mask(&LPC_IOCON->PIO0_8, 0x3, 0x0);
-	set_with_mask(&LPC_IOCON->PIO0_9, 0x3, 0x0);
-	set_with_mask(&LPC_IOCON->SWCLK_PIO0_10, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TDI_PIO0_11, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TMS_PIO0_12, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TDO_PIO0_13, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TRST_PIO0_14, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->SWDIO_PIO0_15, 0x3, 0x1);
-	LPC_GPIO->DIR[0] |= (0xFF << 8);
-
-	LPC_GPIO->MASK[0] = ~(PIN_LED0 | PIN_LED1 | PIN_LED2 | PIN_LED3 | PIN_LED4 | PIN_LED5 | PIN_LED6 | PIN_LED7);
-}
+const char *const boot_phase_names[BOOT_N_PHASES] = {
+	[BOOT_MAIN]        = "MAIN",
+	[BOOT_DISPLAY]     = "DISPLAY",
+	[BOOT_SETTINGS]    = "SETTINGS",
+	[BOOT_FIRST_FRAME] = "FIRST_FRAME",
+	[BOOT_USB]         = "USB",
+	[BOOT_DONE]        = "DONE",
+};
+
+uint32_t boot_cycles[BOOT_N_PHASES];
+/* Core clock during boot, to convert boot_cycles to time */
+uint32_t boot_hz;
+#define boot_mark(_phase) boot_cycles[_phase] = cycle_count()
+
+enum clock_mode {
+	NORMAL,
+	BLANKED,
+	DEMO,
+};
+volatile enum clock_mode mode = NORMAL;
+volatile bool dirty = false;
+/* Segment brightness changed, so the targets need recalculating */
+volatile bool retarget = false;
 
 void u32_to_str(uint32_t val, char *buf)
 {
@@ -363,201 +299,21 @@ void u32_to_str(uint32_t val, char *buf)
 	}
 }
 
-void print_u32(uint32_t val)
-{
-	char buf[11] = "        \r\n";
-	u32_to_str(val, buf);
-	usb_usart_print(buf);
-}
-
-// WAKEUP0 and TIMER_16_1 are used for the button.
-// It's pretty horrible, see button_init() for an overview.
-void WAKEUP0_Handler(void)
-{
-	uint32_t stat = LPC_GPIO_PIN_INT->IST;
-	if (stat & 1) {
-		if (LPC_GPIO_PIN_INT->ISEL & 1) {
-			LPC_CT16B1->TCR = 0x0;
-
-			LPC_GPIO_PIN_INT->ISEL &= ~(1 << 0);
-			LPC_GPIO_PIN_INT->FALL = (1 << 0);
-			LPC_GPIO_PIN_INT->RISE = (1 << 0);
-			LPC_GPIO_PIN_INT->CIENF = (1 << 0);
-			LPC_GPIO_PIN_INT->CIENR = (1 << 0);
-
-			/* Reset to falling-edge triggered */
-			LPC_GPIO_PIN_INT->SIENF = (1 << 0);
-
-			if (LPC_CT16B1->TC < 700) {
-				button = PRESSED;
-			}
-			LPC_CT16B1->TC = 0x0;
-
-		} else {
-			LPC_GPIO_PIN_INT->FALL = (1 << 0);
-			LPC_GPIO_PIN_INT->RISE = (1 << 0);
-			LPC_GPIO_PIN_INT->CIENF = (1 << 0);
-			LPC_GPIO_PIN_INT->CIENR = (1 << 0);
-
-			LPC_CT16B1->MR3 = 150;
-			LPC_CT16B1->MCR = (1 << 9) | (1 << 11);
-			LPC_CT16B1->TC = 0x0;
-			LPC_CT16B1->TCR = 0x1;
-		}
-	}
-	LPC_GPIO_PIN_INT->IST = stat;
-}
-
-void TIMER_16_1_Handler(void)
-{
-	uint32_t status = LPC_CT16B1->IR;
-	if (status & (1 << 3)) {
-		/* 30ms expired */
-		/* Select high level triggered */
-		NVIC_DisableIRQ(FLEX_INT0_IRQn);
-		LPC_GPIO_PIN_INT->ISEL = (1 << 0);
-		LPC_GPIO_PIN_INT->FALL = (1 << 0);
-		LPC_GPIO_PIN_INT->RISE = (1 << 0);
-		LPC_GPIO_PIN_INT->SIENF = (1 << 0);
-		LPC_GPIO_PIN_INT->SIENR = (1 << 0);
-
-		/* Stop after 3s */
-		LPC_CT16B1->MR2 = 2100;
-		LPC_CT16B1->MCR = (1 << 6) | (1 << 8);
-		LPC_CT16B1->TC = 0x0;
-		LPC_CT16B1->TCR = 0x1;
-		NVIC_EnableIRQ(FLEX_INT0_IRQn);
-	}
-	if (status & (1 << 2)) {
-		/* 3s expired */
-		NVIC_DisableIRQ(FLEX_INT0_IRQn);
-		LPC_GPIO_PIN_INT->ISEL &= ~(1 << 0);
-		LPC_GPIO_PIN_INT->FALL = (1 << 0);
-		LPC_GPIO_PIN_INT->CIENF = (1 << 0);
-		LPC_GPIO_PIN_INT->CIENR = (1 << 0);
-		LPC_GPIO_PIN_INT->IST = (1 << 0);
-
-		/* Reset to falling edge */
-		LPC_GPIO_PIN_INT->SIENF = (1 << 0);
-
-		button = HELD;
-		NVIC_EnableIRQ(FLEX_INT0_IRQn);
-	}
-	LPC_CT16B1->IR = status;
-}
-
-// TIMER_32_0 drives the animations, ticking every 10ms
-static void init_timer32()
-{
-	LPC_CTxxBx_Type *timer = LPC_CT32B0;
-
-	NVIC_SetPriority(TIMER_32_0_IRQn, 3);
-	NVIC_EnableIRQ(TIMER_32_0_IRQn);
-
-	/* Turn on the clock - 48MHz */
-	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 9);
-
-	/* 2kHz */
-	timer->PR = 24000;
-
-	/* 10 ms overflow */
-	timer->MR3 = 20;
-	timer->MCR = (1 << 9) | (1 << 10);
-	timer->TCR = 0x1;
-}
-
-const uint32_t anim_length = 2048;
-volatile uint32_t anim_start;
-uint16_t state[N_CHANNELS];
-uint16_t start[N_CHANNELS];
-uint16_t target[N_CHANNELS];
-
-uint32_t ms_since(uint32_t since)
+char *put_hex(char *p, uint32_t val, int digits)
 {
-	uint32_t now = msTicks;
-	if (now < since) {
-		return now + (0xffffffff - since) + 1;
-	}
+	char buf[8];
 
-	return now - since;
-}
-
-uint32_t lerp(uint32_t from, uint32_t to, uint32_t pos, uint32_t max)
-{
-	int32_t diff = to - from;
-	uint32_t x = (pos << 16) / max;
-
-	if (pos >= max) {
-		return to;
-	}
-
-	return from + ((diff * x) / 65536);
-}
-
-void TIMER_32_0_Handler(void)
-{
-	uint32_t status = LPC_CT32B0->IR;
-	if (status & (1 << 3)) {
-		uint32_t tmp = ms_since(anim_start);
-
-		uint32_t i, val = 0;
-		for (i = 0; i < N_CHANNELS; i++) {
-			if (state[i] != target[i]) {
-				val = lerp(start[i], target[i], tmp, anim_length);
-				state[i] = val;
-				pwm_set(channel_map[i], val);
-			}
-		}
-
-		pwm_flip();
-	}
-	LPC_CT32B0->IR = status;
-}
-
-void display(uint8_t sentence)
-{
-	int i;
+	u32_to_str(val, buf);
+	memcpy(p, &buf[8 - digits], digits);
 
-	NVIC_DisableIRQ(TIMER_32_0_IRQn);
-	for (i = 0; i < N_CHANNELS; i++) {
-		start[i] = state[i];
-		if (sentence & (1 << i)) {
-			target[i] = brightness;
-		} else {
-			target[i] = 0;
-		}
-	}
-	anim_start = msTicks;
-	NVIC_EnableIRQ(TIMER_32_0_IRQn);
+	return p + digits;
 }
 
-void button_init(void)
+void print_u32(uint32_t val)
 {
-	// Configure as falling edge interrupt
-	// On falling edge, start timer for 30ms
-	// After 30ms enable high-level interrupt, set timer with 3s timeout
-	// On high level, stop timer - pressed
-	// One timer expire, stop timer - held
-
-	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 19);
-
-	NVIC_SetPriority(FLEX_INT0_IRQn, 3);
-	NVIC_EnableIRQ(FLEX_INT0_IRQn);
-
-	LPC_SYSCON->PINTSEL[0] = 1;
-	LPC_GPIO_PIN_INT->FALL = (1 << 0);
-	LPC_GPIO_PIN_INT->SIENF = (1 << 0);
-
-	LPC_CTxxBx_Type *timer = LPC_CT16B1;
-
-	NVIC_SetPriority(TIMER_16_1_IRQn, 3);
-	NVIC_EnableIRQ(TIMER_16_1_IRQn);
-
-	/* Turn on the clock - 48MHz */
-	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 8);
-
-	/* Ticks at ~732.4 Hz */
-	timer->PR = 65535;
+	char buf[11] = "        \r\n";
+	u32_to_str(val, buf);
+	usb_usart_print(buf);
 }
 
 // FIXME: All the command handling, parsing and printing should be better
@@ -585,19 +341,20 @@ int parse_time(char *buf, char **saveptr, uint16_t *time)
 	return 0;
 }
 
-int parse_u16_hex(char *buf, char **saveptr, uint16_t *val)
+/* Parse "0x" followed by exactly 'digits' hex digits */
+int parse_hex(char *buf, char **saveptr, int digits, uint32_t *val)
 {
 	char *tok = strtok_r(buf, " \r", saveptr);
-	uint16_t tmp = 0;
+	uint32_t tmp = 0;
 	int i;
 	if (tok == NULL) {
 		return -1;
 	}
-	if (strlen(tok) != 6) {
+	if (strlen(tok) != (size_t)(digits + 2)) {
 		return -1;
 	}
 
-	for (i = 2; i < 6; i++) {
+	for (i = 2; i < digits + 2; i++) {
 		tmp <<= 4;
 
 		if ((tok[i] >= 'a') && (tok[i] <= 'f')) {
@@ -614,6 +371,19 @@ int parse_u16_hex(char *buf, char **saveptr, uint16_t *val)
 	return 0;
 }
 
+int parse_u16_hex(char *buf, char **saveptr, uint16_t *val)
+{
+	uint32_t tmp;
+	int ret = parse_hex(buf, saveptr, 4, &tmp);
+	if (ret) {
+		return ret;
+	}
+
+	*val = tmp;
+
+	return 0;
+}
+
 /* 2019-12-25-12:25:00 */
 int parse_datetime(char *buf, char **saveptr, struct rtc_date *date)
 {
@@ -674,27 +444,72 @@ int parse_datetime(char *buf, char **saveptr, struct rtc_date *date)
 	return 0;
 }
 
-int set_meal(int meal, char *buf, char **saveptr)
+/*
+ * Each setting which can be accessed with SET/GET gets one row in the
+ * settings[] table. 'arg' is passed through to the handlers, so that
+ * (e.g.) all of the meal times can share the same parser and formatter.
+ */
+struct setting {
+	const char *name;
+	int (*set)(const struct setting *s, char **saveptr);
+	int (*get)(const struct setting *s);
+	int arg;
+};
+
+int set_date(const struct setting *s, char **saveptr)
+{
+	int ret;
+	struct rtc_date date = { 0 };
+	(void)s;
+
+	ret = parse_datetime(NULL, saveptr, &date);
+	if (ret) {
+		return ret;
+	}
+
+	usb_usart_print("\r\n");
+	usb_usart_print(rtc_date_to_str(&date));
+	rtc_write_date(&date);
+	usb_usart_print("\r");
+
+	return 0;
+}
+
+int get_date(const struct setting *s)
+{
+	struct rtc_date date = { 0 };
+	(void)s;
+
+	rtc_read_date(&date);
+
+	usb_usart_print("\r\n");
+	usb_usart_print(rtc_date_to_str(&date));
+	usb_usart_print("\r\n");
+
+	return 0;
+}
+
+int set_meal(const struct setting *s, char **saveptr)
 {
 	int ret;
 	uint16_t time;
 
-	ret = parse_time(buf, saveptr, &time);
+	ret = parse_time(NULL, saveptr, &time);
 	if (ret) {
 		return ret;
 	}
 
-	return iap_eeprom_write(EEPROM_TIME_OFFSET + (meal * 2), &time, 2);
+	return iap_eeprom_write(EEPROM_TIME_OFFSET + (s->arg * 2), &time, 2);
 }
 
-int get_meal(int meal)
+int get_meal(const struct setting *s)
 {
 	int ret;
 	char buf[10];
 	int idx = 0;
 	uint16_t time = 0;
 
-	ret = iap_eeprom_read(EEPROM_TIME_OFFSET + (meal * 2), &time, 2);
+	ret = iap_eeprom_read(EEPROM_TIME_OFFSET + (s->arg * 2), &time, 2);
 	if (ret) {
 		return ret;
 	}
@@ -713,109 +528,457 @@ int get_meal(int meal)
 	return 0;
 }
 
-int handle_set_command(char *buf, char **saveptr)
+/* Parse and store a u16 setting, and update the copy in RAM */
+static int store_u16(const struct setting *s, char **saveptr, uint16_t *cache)
+{
+	int ret;
+	uint16_t val;
+
+	ret = parse_u16_hex(NULL, saveptr, &val);
+	if (ret) {
+		return ret;
+	}
+
+	ret = iap_eeprom_write(s->arg, &val, 2);
+	if (!ret) {
+		*cache = val;
+	}
+
+	return ret;
+}
+
+int set_brightness(const struct setting *s, char **saveptr)
 {
-	int ret = -1;
-	char *tok = strtok_r(buf, " ", saveptr);
+	return store_u16(s, saveptr, &brightness);
+}
+
+int set_ambient(const struct setting *s, char **saveptr)
+{
+	return store_u16(s, saveptr, &ambient);
+}
+
+int set_night(const struct setting *s, char **saveptr)
+{
+	return store_u16(s, saveptr, &night_brightness);
+}
+
+int get_u16(const struct setting *s)
+{
+	int ret;
+	uint16_t val;
+	char str[] = "\r\n0xXXXXXXXX\r\n";
+
+	ret = iap_eeprom_read(s->arg, &val, 2);
+	if (ret) {
+		return ret;
+	}
+	u32_to_str(val, &str[4]);
+	usb_usart_print(str);
+
+	return 0;
+}
+
+/* Telemetry frame period in ms, 0 to disable. Not stored in EEPROM */
+uint16_t telemetry_period = 0;
+
+int set_telemetry(const struct setting *s, char **saveptr)
+{
+	(void)s;
+
+	return parse_u16_hex(NULL, saveptr, &telemetry_period);
+}
+
+int get_telemetry(const struct setting *s)
+{
+	char str[] = "\r\n0xXXXXXXXX\r\n";
+	(void)s;
+
+	u32_to_str(telemetry_period, &str[4]);
+	usb_usart_print(str);
+
+	return 0;
+}
+
+const struct setting settings[] = {
+	{ "TIME",       set_date, get_date, 0 },
+	{ "BREAKFAST",  set_meal, get_meal, BREAKFAST },
+	{ "LUNCH",      set_meal, get_meal, LUNCH },
+	{ "HOME",       set_meal, get_meal, HOME },
+	{ "DINNER",     set_meal, get_meal, DINNER },
+	{ "BED",        set_meal, get_meal, BED },
+	{ "SLEEP",      set_meal, get_meal, SLEEP },
+	{ "NEARLY",     set_meal, get_meal, NEARLY },
+	{ "PAST",       set_meal, get_meal, PAST },
+	{ "BRIGHTNESS", set_brightness, get_u16, EEPROM_BRIGHTNESS_OFFSET },
+	{ "AMBIENT",    set_ambient, get_u16, EEPROM_AMBIENT_OFFSET },
+	{ "NIGHT",      set_night, get_u16, EEPROM_NIGHT_OFFSET },
+	{ "TELEMETRY",  set_telemetry, get_telemetry, 0 },
+};
+
+static struct keyword_index settings_index = KEYWORD_INDEX(settings);
+
+const struct setting *find_setting(const char *name)
+{
+	int i = keyword_find(&settings_index, name);
+
+	return (i < 0) ? NULL : &settings[i];
+}
+
+int handle_set_command(char **saveptr)
+{
+	int ret;
+	const struct setting *s;
+	char *tok = strtok_r(NULL, " ", saveptr);
 	if (tok == NULL) {
 		return -1;
 	}
 
-	if (!strcmp(tok, "TIME")) {
-		struct rtc_date date = { 0 };
+	s = find_setting(tok);
+	if (!s) {
+		return -1;
+	}
+
+	ret = s->set(s, saveptr);
+	if (!ret) {
+		dirty = true;
+		usb_usart_print("\nOK\r\n");
+	}
 
-		ret = parse_datetime(NULL, saveptr, &date);
-		if (ret) {
-			return ret;
+	return ret;
+}
+
+int handle_get_command(char **saveptr)
+{
+	const struct setting *s;
+	char *tok = strtok_r(NULL, "\r", saveptr);
+	if (tok == NULL) {
+		return -1;
+	}
+
+	s = find_setting(tok);
+	if (!s) {
+		return -1;
+	}
+
+	return s->get(s);
+}
+
+int handle_reset_command(char **saveptr)
+{
+	(void)saveptr;
+
+	usb_usart_print("\nRESET\r\n");
+	NVIC_SystemReset();
+
+	return 0;
+}
+
+int handle_id_command(char **saveptr)
+{
+	int ret;
+	uint32_t *result;
+	char str[9];
+	str[8] = '\0';
+	(void)saveptr;
+
+	ret = iap_read_partid(&result);
+	if (ret) {
+		return ret;
+	}
+	usb_usart_print("\nPARTID: ");
+	u32_to_str(result[0], str);
+	usb_usart_print(str);
+	usb_usart_print("\r");
+
+	ret = iap_read_uid(&result);
+	if (ret) {
+		return ret;
+	}
+	usb_usart_print("\nUID: ");
+	u32_to_str(result[0], str);
+	usb_usart_print(str);
+	usb_usart_print(" ");
+	u32_to_str(result[1], str);
+	usb_usart_print(str);
+	usb_usart_print(" ");
+	u32_to_str(result[2], str);
+	usb_usart_print(str);
+	usb_usart_print(" ");
+	u32_to_str(result[3], str);
+	usb_usart_print(str);
+	usb_usart_print("\r\n");
+
+	return 0;
+}
+
+/* UPDATE 0xSSSSSSSS 0xCCCCCCCC - see updater.h */
+int handle_update_command(char **saveptr)
+{
+	int ret;
+	uint32_t size, crc;
+
+	ret = parse_hex(NULL, saveptr, 8, &size);
+	if (ret) {
+		return ret;
+	}
+
+	ret = parse_hex(NULL, saveptr, 8, &crc);
+	if (ret) {
+		return ret;
+	}
+
+	return updater_start(size, crc);
+}
+
+/* Segment names for COLOUR, indexed by sentence bit */
+const char *const segment_names[DISPLAY_N_SEGMENTS] = {
+	[BREAKFAST] = "BREAKFAST",
+	[LUNCH]     = "LUNCH",
+	[HOME]      = "HOME",
+	[DINNER]    = "DINNER",
+	[BED]       = "BED",
+	[NEARLY]    = "NEARLY",
+	[PAST]      = "PAST",
+	[ITS_TIME]  = "ITS",
+};
+
+/*
+ * COLOUR {<segment>,ALL} 0xRRGGBB 0xBBBB
+ * Colour and relative brightness of a segment, 0x000000 for the default
+ * colour. Not stored in EEPROM.
+ */
+int handle_colour_command(char **saveptr)
+{
+	int ret, i, seg;
+	uint32_t rgb;
+	uint16_t level;
+	char *tok = strtok_r(NULL, " ", saveptr);
+	if (tok == NULL) {
+		return -1;
+	}
+
+	for (seg = 0; seg < DISPLAY_N_SEGMENTS; seg++) {
+		if (!strcmp(tok, segment_names[seg])) {
+			break;
 		}
+	}
+	if ((seg == DISPLAY_N_SEGMENTS) && strcmp(tok, "ALL")) {
+		return -1;
+	}
 
-		usb_usart_print("\r\n");
-		usb_usart_print(rtc_date_to_str(&date));
-		rtc_write_date(&date);
-		usb_usart_print("\r");
-	} else if (!strcmp(tok, "BREAKFAST")) {
-		ret = set_meal(BREAKFAST, NULL, saveptr);
-	} else if (!strcmp(tok, "LUNCH")) {
-		ret = set_meal(LUNCH, NULL, saveptr);
-	} else if (!strcmp(tok, "HOME")) {
-		ret = set_meal(HOME, NULL, saveptr);
-	} else if (!strcmp(tok, "DINNER")) {
-		ret = set_meal(DINNER, NULL, saveptr);
-	} else if (!strcmp(tok, "BED")) {
-		ret = set_meal(BED, NULL, saveptr);
-	} else if (!strcmp(tok, "SLEEP")) {
-		ret = set_meal(SLEEP, NULL, saveptr);
-	} else if (!strcmp(tok, "NEARLY")) {
-		ret = set_meal(NEARLY, NULL, saveptr);
-	} else if (!strcmp(tok, "PAST")) {
-		ret = set_meal(PAST, NULL, saveptr);
-	} else if (!strcmp(tok, "BRIGHTNESS")) {
-		uint16_t val;
-		ret = parse_u16_hex(NULL, saveptr, &val);
-		if (ret) {
-			return ret;
+	ret = parse_hex(NULL, saveptr, 6, &rgb);
+	if (ret) {
+		return ret;
+	}
+
+	ret = parse_u16_hex(NULL, saveptr, &level);
+	if (ret) {
+		return ret;
+	}
+
+	for (i = 0; i < DISPLAY_N_SEGMENTS; i++) {
+		if ((seg == i) || (seg == DISPLAY_N_SEGMENTS)) {
+			display_set_color(disp, i, rgb, level);
 		}
-		brightness = val;
-		ret = iap_eeprom_write(EEPROM_BRIGHTNESS_OFFSET, &val, 2);
 	}
+	retarget = true;
+	dirty = true;
+	usb_usart_print("\nOK\r\n");
 
-	if (!ret) {
-		dirty = true;
+	return 0;
+}
+
+#ifdef ISR_STATS
+/*
+ * STATS [CLEAR]
+ * Print (or clear) the interrupt handler timings, in cycles. One line per
+ * handler: name, count, total, min, max, then the histogram buckets.
+ */
+int handle_stats_command(char **saveptr)
+{
+	struct isr_stat stat;
+	char line[160];
+	char *p;
+	int i, j;
+	char *tok = strtok_r(NULL, " \r", saveptr);
+
+	if (tok && !strcmp(tok, "CLEAR")) {
+		isr_stats_reset();
 		usb_usart_print("\nOK\r\n");
+		return 0;
 	}
 
-	return ret;
+	usb_usart_print("\r\n");
+	for (i = 0; i < ISR_N_IDS; i++) {
+		isr_stats_get(i, &stat);
+
+		p = line;
+		memcpy(p, isr_names[i], strlen(isr_names[i]));
+		p += strlen(isr_names[i]);
+		*p++ = ',';
+		p = put_hex(p, stat.count, 8);
+		*p++ = ',';
+		p = put_hex(p, stat.total >> 32, 8);
+		p = put_hex(p, stat.total, 8);
+		*p++ = ',';
+		p = put_hex(p, stat.min, 8);
+		*p++ = ',';
+		p = put_hex(p, stat.max, 8);
+		for (j = 0; j < ISR_STATS_BUCKETS; j++) {
+			*p++ = ',';
+			p = put_hex(p, stat.hist[j], 8);
+		}
+		*p++ = '\r';
+		*p++ = '\n';
+		*p = '\0';
+		usb_usart_print(line);
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef PROFILE
+static char *put_field(char *p, const char *name, uint32_t val)
+{
+	memcpy(p, name, strlen(name));
+	p += strlen(name);
+	*p++ = ',';
+	p = put_hex(p, val, 8);
+	*p++ = '\r';
+	*p++ = '\n';
+	*p = '\0';
+
+	return p;
 }
 
-int handle_get_command(char *buf, char **saveptr)
+/* Print an "address,count" line for a profile bin */
+static void put_bin(char *line, uint32_t addr, uint16_t count)
 {
-	int ret = -1;
-	char *tok = strtok_r(buf, "\r", saveptr);
+	char *p;
+
+	p = put_hex(line, addr, 8);
+	*p++ = ',';
+	p = put_hex(p, count, 4);
+	*p++ = '\r';
+	*p++ = '\n';
+	*p = '\0';
+	usb_usart_print(line);
+}
+
+/*
+ * PROFILE {START,STOP,CLEAR,DUMP}
+ * DUMP stops the profiler, then prints the totals, followed by one
+ * "address,count" line for each non-empty bin (flash, then SRAM), and END.
+ */
+int handle_profile_command(char **saveptr)
+{
+	const struct profile *prof;
+	char line[24];
+	int i;
+	char *tok = strtok_r(NULL, " \r", saveptr);
+
 	if (tok == NULL) {
 		return -1;
 	}
 
-	if (!strcmp(tok, "TIME")) {
-		struct rtc_date date = { 0 };
-		rtc_read_date(&date);
+	if (!strcmp(tok, "START")) {
+		profile_start();
+	} else if (!strcmp(tok, "STOP")) {
+		profile_stop();
+	} else if (!strcmp(tok, "CLEAR")) {
+		profile_clear();
+	} else if (!strcmp(tok, "DUMP")) {
+		profile_stop();
+		prof = profile_get();
 
 		usb_usart_print("\r\n");
-		usb_usart_print(rtc_date_to_str(&date));
-		usb_usart_print("\r\n");
-		ret = 0;
-	} else if (!strcmp(tok, "BREAKFAST")) {
-		ret = get_meal(BREAKFAST);
-	} else if (!strcmp(tok, "LUNCH")) {
-		ret = get_meal(LUNCH);
-	} else if (!strcmp(tok, "HOME")) {
-		ret = get_meal(HOME);
-	} else if (!strcmp(tok, "DINNER")) {
-		ret = get_meal(DINNER);
-	} else if (!strcmp(tok, "BED")) {
-		ret = get_meal(BED);
-	} else if (!strcmp(tok, "SLEEP")) {
-		ret = get_meal(SLEEP);
-	} else if (!strcmp(tok, "NEARLY")) {
-		ret = get_meal(NEARLY);
-	} else if (!strcmp(tok, "PAST")) {
-		ret = get_meal(PAST);
-	} else if (!strcmp(tok, "BRIGHTNESS")) {
-		uint16_t val;
-		char str[] = "\r\n0xXXXXXXXX\r\n";
-		ret = iap_eeprom_read(EEPROM_BRIGHTNESS_OFFSET, &val, 2);
-		if (ret) {
-			return ret;
+		put_field(line, "SHIFT", PROFILE_SHIFT);
+		usb_usart_print(line);
+		put_field(line, "TOTAL", prof->total);
+		usb_usart_print(line);
+		put_field(line, "OTHER", prof->other);
+		usb_usart_print(line);
+
+		for (i = 0; i < PROFILE_BINS; i++) {
+			if (!prof->bins[i]) {
+				continue;
+			}
+
+			put_bin(line, i << PROFILE_SHIFT, prof->bins[i]);
+		}
+		for (i = 0; i < PROFILE_SRAM_BINS; i++) {
+			if (!prof->sram_bins[i]) {
+				continue;
+			}
+
+			put_bin(line, PROFILE_SRAM_BASE + (i << PROFILE_SHIFT),
+					prof->sram_bins[i]);
 		}
-		u32_to_str(val, &str[4]);
-		usb_usart_print(str);
+		usb_usart_print("END\r\n");
+		return 0;
+	} else {
+		return -1;
 	}
+	usb_usart_print("\nOK\r\n");
 
-	return ret;
+	return 0;
+}
+#endif
+
+/*
+ * BOOT
+ * Print the boot timestamps, one "phase,us" line each
+ */
+int handle_boot_command(char **saveptr)
+{
+	char line[24];
+	char *p;
+	int i;
+	(void)saveptr;
+
+	usb_usart_print("\r\n");
+	for (i = 0; i < BOOT_N_PHASES; i++) {
+		p = line;
+		memcpy(p, boot_phase_names[i], strlen(boot_phase_names[i]));
+		p += strlen(boot_phase_names[i]);
+		*p++ = ',';
+		p = put_hex(p, boot_cycles[i] / (boot_hz / 1000000), 8);
+		*p++ = '\r';
+		*p++ = '\n';
+		*p = '\0';
+		usb_usart_print(line);
+	}
+
+	return 0;
 }
 
+struct command {
+	const char *name;
+	int (*handler)(char **saveptr);
+};
+
+const struct command commands[] = {
+	{ "RESET",  handle_reset_command },
+	{ "ID",     handle_id_command },
+	{ "SET",    handle_set_command },
+	{ "GET",    handle_get_command },
+	{ "UPDATE", handle_update_command },
+	{ "COLOUR", handle_colour_command },
+	{ "BOOT",   handle_boot_command },
+#ifdef ISR_STATS
+	{ "STATS",  handle_stats_command },
+#endif
+#ifdef PROFILE
+	{ "PROFILE", handle_profile_command },
+#endif
+};
+
+static struct keyword_index commands_index = KEYWORD_INDEX(commands);
+
 int handle_command(char *buf)
 {
-	int ret = 0;
+	int i;
 	char *saveptr;
 	char *tok = strtok_r(buf, " \r", &saveptr);
 
@@ -823,54 +986,17 @@ int handle_command(char *buf)
 		return -1;
 	}
 
-	if (!strcmp(tok, "RESET")) {
-		usb_usart_print("\nRESET\r\n");
-		NVIC_SystemReset();
-		return 0;
-	} else if (!strcmp(tok, "ID")) {
-		uint32_t *result;
-		char str[9];
-		str[8] = '\0';
-
-		ret = iap_read_partid(&result);
-		if (ret) {
-			return ret;
-		}
-		usb_usart_print("\nPARTID: ");
-		u32_to_str(result[0], str);
-		usb_usart_print(str);
-		usb_usart_print("\r");
-
-		ret = iap_read_uid(&result);
-		if (ret) {
-			return ret;
-		}
-		usb_usart_print("\nUID: ");
-		u32_to_str(result[0], str);
-		usb_usart_print(str);
-		usb_usart_print(" ");
-		u32_to_str(result[1], str);
-		usb_usart_print(str);
-		usb_usart_print(" ");
-		u32_to_str(result[2], str);
-		usb_usart_print(str);
-		usb_usart_print(" ");
-		u32_to_str(result[3], str);
-		usb_usart_print(str);
-		usb_usart_print("\r\n");
-		return 0;
-	} else if (!strcmp(tok, "SET")) {
-		return handle_set_command(NULL, &saveptr);
-	} else if (!strcmp(tok, "GET")) {
-		return handle_get_command(NULL, &saveptr);
+	i = keyword_find(&commands_index, tok);
+	if (i < 0) {
+		return -1;
 	}
 
-	return -1;
+	return commands[i].handler(&saveptr);
 }
 
 void handle_usart()
 {
-	static char buf[32];
+	static char buf[48];
 	static unsigned int len = 0;
 	int ret = 0;
 
@@ -901,89 +1027,331 @@ void handle_usart()
 	}
 }
 
-int main(void)
-{
-	SystemInit();
-	SystemCoreClockUpdate();
-	SysTick_Config(SystemCoreClock/1000);
+/*
+ * Vendor interface protocol
+ *
+ * Each request is a single packet starting with an opcode byte. The reply
+ * is a single packet starting with the same opcode, or VENDOR_ERR if the
+ * request couldn't be handled.
+ */
+#define VENDOR_PING       0x00 /* Reply with the request payload */
+#define VENDOR_GET_STATUS 0x01 /* Reply with struct vendor_status */
+#define VENDOR_SET_MODE   0x02 /* Payload: 1 byte enum clock_mode */
+#define VENDOR_ERR        0xff
+
+struct __attribute__((packed)) vendor_status {
+	uint8_t opcode;
+	uint8_t mode;
+	uint8_t band;
+	uint8_t sentence;
+	uint16_t brightness;
+	uint8_t hours;
+	uint8_t minutes;
+	uint8_t seconds;
+	uint16_t state[DISPLAY_N_SEGMENTS];
+};
 
-#ifdef DEBUG
-	LPC_GPIO->DIR[DBG_PORT] |= DBG_PIN | DBG_PIN1;
-	LPC_GPIO->CLR[DBG_PORT] = DBG_PIN | DBG_PIN1;
-#endif
+/* Length of a reply which couldn't be sent yet, 0 if there isn't one */
+static int vendor_resp_len;
 
-	button_init();
-	rtc_init();
-	usb_init();
-	leds_init();
-	init_timer32();
+/* A request is waiting, and handle_vendor() will be able to answer it */
+bool vendor_ready(void)
+{
+	return usb_vendor_pending() && !vendor_resp_len &&
+		!usb_suspended() && !updater_active();
+}
 
-	delay_ms(100);
+void handle_vendor(int band, struct rtc_date *date)
+{
+	static uint8_t req[USB_VENDOR_PACKET_SIZE];
+	static uint8_t resp[USB_VENDOR_PACKET_SIZE];
+	struct vendor_status *status = (struct vendor_status *)resp;
+	uint16_t level[DISPLAY_N_SEGMENTS], target[DISPLAY_N_SEGMENTS];
+	int len, i;
 
-	init_timer16();
+	/*
+	 * If the host hasn't collected the last reply yet, hold on to it and
+	 * leave any new request NAKed until it has
+	 */
+	if (vendor_resp_len) {
+		if (usb_vendor_send(resp, vendor_resp_len) < 0) {
+			return;
+		}
+		vendor_resp_len = 0;
+	}
 
-	int ret, i = 0;
+	len = usb_vendor_recv(req);
+	if (len <= 0) {
+		return;
+	}
 
-	uint32_t magic = 0;
-	ret = iap_eeprom_read(0, &magic, 4);
-	if (ret == 0) {
-		if (magic == EEPROM_MAGIC) {
-			/* Load times from EEPROM */
-			for (i = 0; i < N_TIMES; i++) {
-				ret = iap_eeprom_read(EEPROM_TIME_OFFSET + (i * 2), &times[i], 2);
-				if (ret != 0) {
-					break;
-				}
-			}
-			iap_eeprom_read(EEPROM_BRIGHTNESS_OFFSET, &brightness, 2);
+	resp[0] = req[0];
+	switch (req[0]) {
+	case VENDOR_PING:
+		memcpy(resp, req, len);
+		break;
+	case VENDOR_GET_STATUS:
+		status->mode = mode;
+		status->band = band;
+		status->sentence = timebands[band].sentence;
+		status->brightness = brightness;
+		status->hours = date->hours;
+		status->minutes = date->minutes;
+		status->seconds = date->seconds;
+		display_get_levels(disp, level, target);
+		for (i = 0; i < DISPLAY_N_SEGMENTS; i++) {
+			status->state[i] = level[i];
+		}
+		len = sizeof(*status);
+		break;
+	case VENDOR_SET_MODE:
+		if ((len < 2) || (req[1] > DEMO)) {
+			resp[0] = VENDOR_ERR;
 		} else {
-			/* Store defaults to EEPROM */
-			for (i = 0; i < N_TIMES; i++) {
-				ret = iap_eeprom_write(EEPROM_TIME_OFFSET + (i * 2), &times[i], 2);
-				if (ret != 0) {
-					break;
-				}
-			}
-			ret = iap_eeprom_write(EEPROM_BRIGHTNESS_OFFSET, &brightness, 2);
-			if (ret == 0) {
-				magic = EEPROM_MAGIC;
-				iap_eeprom_write(0, &magic, 4);
-			}
+			mode = req[1];
+			dirty = true;
+		}
+		len = 1;
+		break;
+	default:
+		resp[0] = VENDOR_ERR;
+		len = 1;
+	}
+
+	if (usb_vendor_send(resp, len) < 0) {
+		vendor_resp_len = len;
+	}
+}
+
+/*
+ * Telemetry
+ *
+ * Every telemetry_period ms, a status frame is sent on the serial port as
+ * a line of CSV, prefixed with "T," so it can be picked out from any
+ * other output:
+ *
+ *   T,ms,band,mode,hhmmss,level0:target0,...,level7:target7,bcm_irqs,anim_irqs,idle%
+ *
+ * All values are hex, except hhmmss which is BCD. Interrupt counts are
+ * free-running totals. Idle is the percentage of time since the previous
+ * frame spent sleeping in the main loop.
+ * The frame goes out asynchronously. If the previous one is still being
+ * sent, the frame is skipped rather than holding up the main loop.
+ */
+uint32_t idle_cycles;
+
+void handle_telemetry(int band, struct rtc_date *date)
+{
+	static char frame[128];
+	static uint32_t last_frame, last_cycles;
+	uint16_t level[DISPLAY_N_SEGMENTS], target[DISPLAY_N_SEGMENTS];
+	uint32_t now, total, idle = 0;
+	char *p = frame;
+	int i;
+
+	if (!telemetry_period || (ms_since(last_frame) < telemetry_period)) {
+		return;
+	}
+	if (usb_usart_tx_busy()) {
+		return;
+	}
+	last_frame = msTicks;
+
+	now = cycle_count();
+	total = (now - last_cycles) / 100;
+	if (total) {
+		idle = idle_cycles / total;
+	}
+	last_cycles = now;
+	idle_cycles = 0;
+
+	*p++ = 'T';
+	*p++ = ',';
+	p = put_hex(p, msTicks, 8);
+	*p++ = ',';
+	p = put_hex(p, band, 2);
+	*p++ = ',';
+	p = put_hex(p, mode, 1);
+	*p++ = ',';
+	p = put_hex(p, date->hours, 2);
+	p = put_hex(p, date->minutes, 2);
+	p = put_hex(p, date->seconds, 2);
+	display_get_levels(disp, level, target);
+	for (i = 0; i < DISPLAY_N_SEGMENTS; i++) {
+		*p++ = ',';
+		p = put_hex(p, level[i], 4);
+		*p++ = ':';
+		p = put_hex(p, target[i], 4);
+	}
+	*p++ = ',';
+	p = put_hex(p, bcm_isr_count, 8);
+	*p++ = ',';
+	p = put_hex(p, anim_isr_count, 8);
+	*p++ = ',';
+	p = put_hex(p, idle, 2);
+	*p++ = '\r';
+	*p++ = '\n';
+
+	usb_usart_send_async(frame, p - frame);
+}
+
+/*
+ * Night is the blank part of the day, from BED + SLEEP until
+ * BREAKFAST - NEARLY. The display timers and core clock slow down, and
+ * the display is either off, or shows the last sentence at
+ * night_brightness.
+ */
+bool night = false;
+
+bool is_night(int band)
+{
+	return (mode != DEMO) && (timebands[band].sentence == 0);
+}
+
+uint8_t band_sentence(int band)
+{
+	/* The band before BED + SLEEP is "IT'S PAST BED TIME" */
+	if (is_night(band) && night_brightness) {
+		return timebands[n_timebands - 2].sentence;
+	}
+
+	return timebands[band].sentence;
+}
+
+/*
+ * The stored brightness (or night_brightness at night), scaled by the
+ * ambient light level if that's turned on. Zero when blanked.
+ */
+uint16_t master_brightness(void)
+{
+	uint32_t level = night ? night_brightness : brightness;
+
+	if (mode == BLANKED) {
+		return 0;
+	}
+
+	if (ambient) {
+		level = (level * ambient_brightness()) >> 16;
+	}
+
+	return level;
+}
+
+/*
+ * Full speed while USB is up. Otherwise the display is all that's
+ * running, and when it's blank the BCM interrupt has nothing to show, so
+ * doesn't matter if it can't keep up. At night it's running at half rate,
+ * so keeps up at 12 MHz.
+ */
+void update_clock(void)
+{
+	enum clock_speed speed = CLOCK_48MHZ;
+
+	if (usb_suspended()) {
+		speed = ((mode == BLANKED) || night) ? CLOCK_IRC : CLOCK_24MHZ;
+
+		/*
+		 * WS2812 strips can't get their bit rate from the IRC, and the
+		 * GPIO display needs a fast enough core. Step up until the
+		 * display is happy - the enum runs from fastest to slowest.
+		 */
+		while ((speed != CLOCK_48MHZ) && !display_clock_ok(disp, speed)) {
+			speed--;
 		}
 	}
 
+	if (speed != clock_get()) {
+		clock_set(speed);
+		display_clock_changed(disp);
+#ifdef PROFILE
+		profile_clock_changed();
+#endif
+	}
+}
+
+int main(void)
+{
+	SystemInit();
+	SystemCoreClockUpdate();
+	SysTick_Config(SystemCoreClock/1000);
+	boot_mark(BOOT_MAIN);
+	boot_hz = SystemCoreClock;
+
+	/*
+	 * Get the right sentence up as soon as possible, and leave USB and
+	 * anything else which can wait until after that.
+	 */
+	button_init();
+	rtc_init();
+	disp = display_init();
+	ambient_init();
+	boot_mark(BOOT_DISPLAY);
+
+	bool settings_valid = load_settings();
 	build_timebands();
+	boot_mark(BOOT_SETTINGS);
+
+	struct rtc_date date = { 0 };
+	rtc_read_date(&date);
+	int band = find_band(TIME(date.hours, date.minutes));
+	night = is_night(band);
+	display_set_night(disp, night);
+	uint8_t sentence = band_sentence(band), shown = sentence;
+	uint16_t master = master_brightness();
+	display_set_brightness(disp, master);
+	display_transition(disp, 0, sentence);
+	boot_mark(BOOT_FIRST_FRAME);
+
+	/* Enumeration carries on in the background, from the USB interrupt */
+	usb_init();
+#ifdef PROFILE
+	profile_init();
+#endif
+	boot_mark(BOOT_USB);
+
+	if (!settings_valid) {
+		store_settings();
+	}
+	boot_mark(BOOT_DONE);
 
-	struct rtc_date date;
-	uint8_t sentence = 0;
-	int band = 0;
 	uint32_t demo_last_change = 0;
+	enum button_event ev;
 	while(1) {
 		// FIXME: All of the state tracking and transition handling is
 		// pretty ugly here. Could come up with something better.
 		// Also, disabling the screen refresh and going into sleep when
 		// the screen is static would save a little bit of power
 		// (SysTick would need to be stopped too).
-		if (button == PRESSED) {
-			if (mode == NORMAL) {
-				mode = BLANKED;
-			} else if (mode == BLANKED) {
-				mode = NORMAL;
-			}
-			dirty = true;
-			button = NONE;
-		} else if (button == HELD) {
-			if (mode == DEMO) {
-				mode = NORMAL;
-			} else if ((mode == NORMAL) || (mode == BLANKED)) {
-				mode = DEMO;
+		if (button_pending() && usb_suspended()) {
+			usb_remote_wakeup();
+		}
+
+		while ((ev = button_poll()) != BUTTON_NONE) {
+			switch (ev) {
+			case BUTTON_SHORT:
+				if (mode == NORMAL) {
+					mode = BLANKED;
+				} else if (mode == BLANKED) {
+					mode = NORMAL;
+				}
+				dirty = true;
+				break;
+			case BUTTON_LONG:
+				if (mode == DEMO) {
+					mode = NORMAL;
+				} else if ((mode == NORMAL) || (mode == BLANKED)) {
+					mode = DEMO;
+				}
+				dirty = true;
+				break;
+			default:
+				/* Nothing uses DOUBLE or REPEAT yet */
+				break;
 			}
-			dirty = true;
-			button = NONE;
 		}
 
 		if (mode == DEMO) {
-			if (ms_since(demo_last_change) >= anim_length + 512) {
+			if (ms_since(demo_last_change) >= DEMO_PERIOD) {
 				demo_last_change = msTicks;
 				band++;
 			}
@@ -992,16 +1360,16 @@ int main(void)
 			}
 		} else {
 			rtc_read_date(&date);
-			uint16_t time = TIME(date.hours, date.minutes);
-			for (i = 0; i < n_timebands; i++) {
-				if (time >= timebands[i].start) {
-					band = i;
-				}
-			}
+			band = find_band(TIME(date.hours, date.minutes));
 		}
 
-		if (timebands[band].sentence != sentence) {
-			sentence = timebands[band].sentence;
+		if (is_night(band) != night) {
+			night = !night;
+			display_set_night(disp, night);
+		}
+
+		if (band_sentence(band) != sentence) {
+			sentence = band_sentence(band);
 			if ((mode == BLANKED) &&
 			    (sentence & (BIT(NEARLY)) &&
 			    (sentence & (BIT(BREAKFAST))))) {
@@ -1010,19 +1378,45 @@ int main(void)
 			dirty = true;
 		}
 
-		handle_usart();
+		if (usb_suspended()) {
+			usb_suspend_idle();
+		} else if (updater_active()) {
+			updater_poll();
+		} else {
+			handle_usart();
+			handle_vendor(band, &date);
+			handle_telemetry(band, &date);
+		}
+
+		update_clock();
+
+		/* Blanking only ramps the master brightness down */
+		uint16_t level = master_brightness();
+		if (level != master) {
+			master = level;
+			display_set_brightness(disp, master);
+		}
 
 		if (dirty) {
-			if (mode == BLANKED) {
-				brightness = 0;
-			} else {
-				iap_eeprom_read(EEPROM_BRIGHTNESS_OFFSET, &brightness, 2);
+			if ((sentence != shown) || retarget) {
+				display_transition(disp, shown, sentence);
+				shown = sentence;
+				retarget = false;
 			}
-			display(timebands[band].sentence);
 			dirty = false;
 		}
 
-		delay_ms(10);
+		/*
+		 * Sleep until the next tick. Wake up early for vendor
+		 * requests which can be answered straight away, to keep
+		 * latency down
+		 */
+		uint32_t tick = msTicks;
+		uint32_t idle_start = cycle_count();
+		while (((msTicks - tick) < 10) && !vendor_ready()) {
+			__WFI();
+		}
+		idle_cycles += cycle_count() - idle_start;
 	}
 
 	return 0;
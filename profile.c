@@ -0,0 +1,104 @@
+/*
+ * Statistical profiler
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "LPC11Uxx.h"
+
+#include "profile.h"
+
+static struct profile profile;
+
+/* Called with the interrupted PC, from TIMER_32_1_Handler */
+void profile_sample(uint32_t pc)
+{
+	uint32_t sram = pc - PROFILE_SRAM_BASE;
+	uint16_t *bin;
+
+	LPC_CT32B1->IR = LPC_CT32B1->IR;
+	profile.total++;
+
+	if (pc < (PROFILE_BINS << PROFILE_SHIFT)) {
+		bin = &profile.bins[pc >> PROFILE_SHIFT];
+	} else if (sram < (PROFILE_SRAM_BINS << PROFILE_SHIFT)) {
+		bin = &profile.sram_bins[sram >> PROFILE_SHIFT];
+	} else {
+		profile.other++;
+		return;
+	}
+
+	/* Saturate, rather than wrapping */
+	if (*bin != 0xffff)
+		(*bin)++;
+}
+
+/*
+ * On exception entry, the hardware pushes r0-r3, r12, lr, pc and xPSR,
+ * so the interrupted PC is at sp + 24. Nothing here uses the process
+ * stack, so it's always on the main stack.
+ * profile_sample() returns straight from the exception, as lr still
+ * holds EXC_RETURN.
+ */
+__attribute__((naked)) void TIMER_32_1_Handler(void)
+{
+	__asm volatile(
+		"ldr r0, [sp, #24]\n"
+		"ldr r1, =profile_sample\n"
+		"bx r1\n"
+		".align 2\n"
+		".ltorg\n"
+	);
+}
+
+void profile_init(void)
+{
+	LPC_CTxxBx_Type *timer = LPC_CT32B1;
+
+	/*
+	 * As high as the M0 goes, so most interrupt handlers get sampled
+	 * too. The BCM timer and WS2812 SSP are at 0 as well, and can't be
+	 * interrupted - samples wait until they return, and land on
+	 * whatever runs next. Use the STATS command (make STATS=1) to time
+	 * those.
+	 */
+	NVIC_SetPriority(TIMER_32_1_IRQn, 0);
+	NVIC_EnableIRQ(TIMER_32_1_IRQn);
+
+	/* Turn on the clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 10);
+
+	timer->PR = 0;
+	timer->MR0 = (SystemCoreClock / PROFILE_RATE) - 1;
+	/* Interrupt and reset on MR0 */
+	timer->MCR = (1 << 0) | (1 << 1);
+}
+
+void profile_clock_changed(void)
+{
+	LPC_CT32B1->MR0 = (SystemCoreClock / PROFILE_RATE) - 1;
+	/* Clear the counter, in case it's past the new MR0 */
+	LPC_CT32B1->TC = 0;
+}
+
+void profile_start(void)
+{
+	LPC_CT32B1->TCR = 0x1;
+}
+
+void profile_stop(void)
+{
+	LPC_CT32B1->TCR = 0x0;
+}
+
+void profile_clear(void)
+{
+	NVIC_DisableIRQ(TIMER_32_1_IRQn);
+	memset(&profile, 0, sizeof(profile));
+	NVIC_EnableIRQ(TIMER_32_1_IRQn);
+}
+
+const struct profile *profile_get(void)
+{
+	return &profile;
+}
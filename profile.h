@@ -0,0 +1,47 @@
+/*
+ * Statistical profiler
+ *
+ * CT32B1 interrupts at PROFILE_RATE Hz, and bins the PC of whatever it
+ * interrupted. The histogram can be dumped over the serial port with
+ * "PROFILE DUMP", and turned into a flat profile with profile.py.
+ * Build with PROFILE defined (make PROFILE=1) to enable.
+ */
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+#include <stdint.h>
+
+/* Deliberately not a multiple of the 10 ms tick */
+#define PROFILE_RATE 997
+
+/* Each bin covers (1 << PROFILE_SHIFT) bytes of the application flash */
+#define PROFILE_SHIFT 6
+#define PROFILE_BINS  ((16 * 1024) >> PROFILE_SHIFT)
+
+/*
+ * RAMFUNC code (.ramfunc) is at the bottom of SRAM, so only the first
+ * couple of kB get bins of their own.
+ */
+#define PROFILE_SRAM_BASE 0x10000000
+#define PROFILE_SRAM_BINS ((2 * 1024) >> PROFILE_SHIFT)
+
+struct profile {
+	uint16_t bins[PROFILE_BINS];
+	uint16_t sram_bins[PROFILE_SRAM_BINS];
+	/* Samples anywhere else (ROM drivers) */
+	uint32_t other;
+	uint32_t total;
+};
+
+void profile_init(void);
+
+/* Keep the sample rate after SystemCoreClock changes */
+void profile_clock_changed(void);
+
+void profile_start(void);
+void profile_stop(void);
+void profile_clear(void);
+
+/* Stop sampling first for a consistent view */
+const struct profile *profile_get(void);
+
+#endif /* __PROFILE_H__ */
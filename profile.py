@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+#
+# Fetch the PC-sampling profile from the clock (make PROFILE=1), and print
+# a flat profile by function, symbolised against the ELF.
+#
+# Usage: profile.py TTY ELF [NM]
+#
+# Start sampling with "PROFILE START" first, and leave it running under
+# whatever load is interesting. Bins cover 1 << SHIFT bytes, so a bin
+# which spans two functions is split between them by the size of overlap.
+# SRAM bins are at their run addresses, which is where nm puts the
+# .ramfunc symbols, so RAMFUNC code is symbolised the same way.
+import os
+import select
+import subprocess
+import sys
+
+# Give up if the clock goes quiet for this long, in seconds
+TIMEOUT = 2
+
+def read_dump(tty):
+    fd = os.open(tty, os.O_RDWR | os.O_NOCTTY)
+    subprocess.check_call(["stty", "-F", tty, "raw", "-echo"])
+    os.write(fd, b"PROFILE DUMP\r")
+
+    fields, bins = {}, {}
+    buf = b""
+    while True:
+        while b"\n" not in buf:
+            if not select.select([fd], [], [], TIMEOUT)[0]:
+                os.close(fd)
+                sys.exit("Timed out waiting for the dump (PROFILE=1 build?)")
+            buf += os.read(fd, 256)
+        line, buf = buf.split(b"\n", 1)
+        # Older firmware sends a NUL after each string
+        line = line.decode("ascii", "replace").strip("\x00\r\n ")
+
+        if line == "END":
+            break
+        parts = line.split(",")
+        if len(parts) != 2:
+            # Echo, telemetry or anything else
+            continue
+        key, val = parts
+        if key in ("SHIFT", "TOTAL", "OTHER"):
+            fields[key] = int(val, 16)
+        else:
+            try:
+                bins[int(key, 16)] = int(val, 16)
+            except ValueError:
+                continue
+    os.close(fd)
+
+    return fields, bins
+
+def read_symbols(elf, nm):
+    out = subprocess.check_output([nm, "-S", "-n", "--defined-only", elf])
+    syms = []
+    for line in out.decode().splitlines():
+        parts = line.split()
+        if len(parts) != 4 or parts[2] not in "tTwW":
+            continue
+        # Thumb symbols have the low bit set
+        addr = int(parts[0], 16) & ~1
+        syms.append((addr, int(parts[1], 16), parts[3]))
+
+    return syms
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("Usage: %s TTY ELF [NM]" % sys.argv[0])
+    nm = sys.argv[3] if len(sys.argv) > 3 else "arm-none-eabi-nm"
+
+    fields, bins = read_dump(sys.argv[1])
+    syms = read_symbols(sys.argv[2], nm)
+    binsz = 1 << fields["SHIFT"]
+
+    funcs = {}
+    for start, count in bins.items():
+        end = start + binsz
+        covered = 0
+        for addr, size, name in syms:
+            overlap = min(end, addr + size) - max(start, addr)
+            if overlap > 0:
+                funcs[name] = funcs.get(name, 0) + count * overlap / binsz
+                covered += overlap
+        if covered < binsz:
+            name = "0x%08x" % start
+            funcs[name] = funcs.get(name, 0) + count * (binsz - covered) / binsz
+
+    funcs["[other]"] = fields["OTHER"]
+
+    total = fields["TOTAL"] or 1
+    print("%d samples, %d byte bins" % (fields["TOTAL"], binsz))
+    for name, count in sorted(funcs.items(), key=lambda f: -f[1]):
+        if count:
+            print("%6.2f%% %8.1f  %s" % (100.0 * count / total, count, name))
+
+if __name__ == "__main__":
+    main()
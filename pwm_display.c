@@ -1,70 +0,0 @@
-/*
- * PWM segment display implementation
- *
- * Copyright Brian Starkey 2016 <stark3y@gmail.com>
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in
- * all copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
- * THE SOFTWARE.
- */
-#include "pwm.h"
-#include "segment_display.h"
-#include "util.h"
-
-#if 0
-/* TODO: Just storing this code away */
-struct pwm_16b *pwm;
-uint32_t *fade_out;
-uint32_t *fade_in;
-uint32_t onscreen = 0;
-static void do_fade(void)
-{
-	uint8_t level = 0xFF;
-	do {
-		level--;
-		pwm_set(pwm, 0, level);
-		pwm_set(pwm, 1, ~level);
-		delay_ms(18);
-	} while (level);
-}
-
-void display(uint32_t sentence)
-{
-	*fade_in = sentence & ~onscreen;
-	*fade_out = onscreen & ~sentence;
-	onscreen = sentence;
-	pwm_set(pwm, 0, 0xFF);
-	pwm_set(pwm, 1, 0);
-	pwm_start(pwm);
-	do_fade();
-	pwm_stop(pwm);
-}
-
-void setup_leds(void)
-{
-	/* Set all our LED pins as GPIO outputs */
-	set_with_mask(&LPC_IOCON->PIO0_8, 0x3, 0x0);
-	set_with_mask(&LPC_IOCON->PIO0_9, 0x3, 0x0);
-	set_with_mask(&LPC_IOCON->SWCLK_PIO0_10, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TDI_PIO0_11, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TMS_PIO0_12, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TDO_PIO0_13, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->TRST_PIO0_14, 0x3, 0x1);
-	set_with_mask(&LPC_IOCON->SWDIO_PIO0_15, 0x3, 0x1);
-	LPC_GPIO->DIR[0] |= (0xFF << 8);
-}
-#endif
@@ -24,16 +24,72 @@
 #ifndef __SEGMENT_DISPLAY_H__
 #define __SEGMENT_DISPLAY_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
-#include "spi.h"
+#include "clock.h"
+
+/* One segment for each bit of a sentence */
+#define DISPLAY_N_SEGMENTS 8
 
 struct segment_display;
-/* TODO: How do we handle colours? */
 typedef uint32_t segment_mask;
 
-struct segment_display *display_init(struct spi_dev *spi);
+/* Use the backend's own colour for a segment */
+#define DISPLAY_COLOR_DEFAULT 0
+
+/* Interrupt counts, for telemetry. Zero if the backend doesn't use them */
+extern volatile uint32_t bcm_isr_count;
+extern volatile uint32_t anim_isr_count;
+
+/* Set up the display hardware, with all segments off */
+struct segment_display *display_init(void);
+
+/* Re-tune the display's timers (and SPI) after SystemCoreClock changes */
+void display_clock_changed(struct segment_display *disp);
+
+/* Return true if the display can run with the clocks set to 'speed' */
+bool display_clock_ok(struct segment_display *disp, enum clock_speed speed);
+
+/*
+ * Night mode: run the display timers slower, to save power. The animation
+ * tick goes from 10 ms to 40 ms, so fades and master brightness ramps
+ * take the same time but in bigger steps. The GPIO display refreshes at
+ * half rate.
+ */
+void display_set_night(struct segment_display *disp, bool night);
+
+/* Master brightness, applied on top of everything else
+ *
+ * Ramps to the new level over DISPLAY_BRIGHTNESS_RAMP_MS (for a full-scale
+ * change), independently of any transition, so it can be used for
+ * blanking without disturbing the segments underneath.
+ */
+#define DISPLAY_BRIGHTNESS_RAMP_MS 200
+void display_set_brightness(struct segment_display *disp, uint16_t brightness);
+
+/* Set the colour (0xRRGGBB) and relative brightness of one segment
+ *
+ * 'brightness' is scaled by the display brightness. Backends which can't
+ * do colour ignore 'rgb'. A new brightness takes effect from the next
+ * display_transition(), a new colour straight away.
+ */
+void display_set_color(struct segment_display *disp, int segment,
+		uint32_t rgb, uint16_t brightness);
+
+/* Fade from showing the segments in 'from' to showing the ones in 'to'
+ *
+ * Segments in both are faded to their relative brightness (from
+ * display_set_color()).
+ */
 void display_transition(struct segment_display * disp,
 		segment_mask from, segment_mask to);
 
+/*
+ * Read back the current and target level of each segment (0 - 0xffff),
+ * before the master brightness is applied
+ */
+void display_get_levels(struct segment_display *disp, uint16_t *level,
+		uint16_t *target);
+
 #endif /* __SEGMENT_DISPLAY_H__ */
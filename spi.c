@@ -23,7 +23,9 @@
  */
 
 #include "lpc11uxx/LPC11Uxx.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include "isr_stats.h"
 #include "spi.h"
 
 /* Control Register 0 */
@@ -54,6 +56,12 @@
 
 #define SSP_FIFO_SIZE 8
 
+/* Divider limits */
+#define CLKDIV_MAX        255
+#define CPSR_MIN          2
+#define CPSR_MAX          254
+#define SCR_MAX           255
+
 struct spi_iocfg {
 	__IO uint32_t *regs[3];
 	uint32_t iocon[3];
@@ -77,21 +85,53 @@ static const struct spi_iocfg spi_iocfgs[] = {
 		.clk_bit = 11,
 		.rst_bit = 0,
 	},
+	[SSP1] = {
+		.regs = {
+			&LPC_IOCON->PIO0_22,
+			&LPC_IOCON->PIO0_21,
+			&LPC_IOCON->PIO1_15
+		},
+		/* As SSP0. MISO1 shares with AD6, so needs digital mode too */
+		.iocon = {
+			(1 << 10) | (1 << 7) | (3 << 0),
+			(1 << 10) | (2 << 0),
+			(1 << 10) | (3 << 0)
+		},
+		.clk_bit = 18,
+		.rst_bit = 2,
+	},
 };
 
 struct spi_dev {
 	/* Static instance data */
 	const struct spi_iocfg *const iocfg;
 	LPC_SSPx_Type *const base;
+	const IRQn_Type irq;
 
 	/* Runtime Config */
 	enum spi_framesz frame_size;
+	uint32_t rate;
+
+	/* Asynchronous transfer state */
+	const void *tx_data;
+	void *rx_data;
+	size_t tx_len;
+	size_t rx_len;
+	spi_callback callback;
+	void *cb_arg;
+	volatile bool busy;
 };
 
 struct spi_dev spi_devices[] = {
 	[SSP0] = {
 		.iocfg = &spi_iocfgs[SSP0],
 		.base = LPC_SSP0,
+		.irq = SSP0_IRQn,
+	},
+	[SSP1] = {
+		.iocfg = &spi_iocfgs[SSP1],
+		.base = LPC_SSP1,
+		.irq = SSP1_IRQn,
 	},
 };
 
@@ -109,12 +149,6 @@ struct spi_dev *spi_init(enum ssp_select devno, enum spi_framesz framesz)
 	/* Turn on the clock */
 	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << pincfg->clk_bit);
 
-	switch (devno) {
-	case SSP0:
-		/* FIXME: Configurable clock speed */
-		LPC_SYSCON->SSP0CLKDIV = 24;
-	}
-
 	/* Set up the pins */
 	*pincfg->regs[0] = pincfg->iocon[0]; /* MISO */
 	*pincfg->regs[1] = pincfg->iocon[1]; /* MOSI */
@@ -122,54 +156,246 @@ struct spi_dev *spi_init(enum ssp_select devno, enum spi_framesz framesz)
 
 	spi_reset(dev);
 
-	/* FIXME: What to do here? */
-	dev->base->CPSR = 2;
-
-	/* FIXME: What SCR do we want? */
-	dev->base->CR0 = CR0_DSS(framesz) | CR0_FRF(FRF_SPI);
+	dev->frame_size = framesz;
+	spi_set_rate(dev, SPI_DEFAULT_RATE);
 
+	dev->base->IMSC = 0;
 	dev->base->CR1 = CR1_SSE;
 
+	/* High priority, so that the FIFO doesn't run dry */
+	NVIC_SetPriority(dev->irq, 1);
+	NVIC_EnableIRQ(dev->irq);
+
 	return dev;
 }
 
-void spi_transfer(struct spi_dev *dev, void *tx_data, void *rx_data,
-		size_t len)
+int spi_calc_dividers(uint32_t pclk, uint32_t rate, struct spi_dividers *div)
 {
-	uint32_t i = 0;
-
-	while (len--) {
-		if (tx_data) {
-			if (dev->frame_size > FRAMESZ_8BIT) {
-				/* Apparently I can't do this in one go */
-				LPC_SSP0->DR = *(uint16_t *)tx_data;
-				tx_data = (uint16_t *)tx_data + 1;
-			} else {
-				LPC_SSP0->DR = *(uint8_t *)tx_data;
-				tx_data = (uint8_t *)tx_data + 1;
+	uint32_t min_div, best = 0;
+	uint32_t clkdiv, cpsr, scr;
+
+	if (!rate)
+		return -1;
+
+	/* The smallest total divider that doesn't go faster than "rate" */
+	min_div = (pclk + rate - 1) / rate;
+	if (min_div < CPSR_MIN)
+		min_div = CPSR_MIN;
+
+	for (cpsr = CPSR_MIN; cpsr <= CPSR_MAX; cpsr += 2) {
+		for (clkdiv = 1; clkdiv <= CLKDIV_MAX; clkdiv++) {
+			uint32_t pre = clkdiv * cpsr;
+			uint32_t total;
+
+			scr = (min_div + pre - 1) / pre;
+			if (scr > SCR_MAX + 1)
+				continue;
+
+			total = pre * scr;
+			if (!best || total < best) {
+				best = total;
+				div->clkdiv = clkdiv;
+				div->cpsr = cpsr;
+				div->scr = scr - 1;
 			}
+
+			/* Any larger clkdiv only gets further away */
+			if (pre >= min_div)
+				break;
+		}
+
+		if (best == min_div)
+			break;
+	}
+
+	if (!best)
+		return -1;
+
+	return pclk / best;
+}
+
+uint32_t spi_set_rate(struct spi_dev *dev, uint32_t rate)
+{
+	/* The SSP clock dividers are fed from the main clock, not the AHB clock */
+	uint32_t pclk = SystemCoreClock * LPC_SYSCON->SYSAHBCLKDIV;
+	struct spi_dividers div;
+	int achieved;
+
+	achieved = spi_calc_dividers(pclk, rate, &div);
+	if (achieved < 0)
+		return 0;
+
+	/* Don't change the clock under a transfer */
+	spi_wait(dev);
+
+	switch (dev - spi_devices) {
+	case SSP0:
+		LPC_SYSCON->SSP0CLKDIV = div.clkdiv;
+		break;
+	case SSP1:
+		LPC_SYSCON->SSP1CLKDIV = div.clkdiv;
+		break;
+	}
+
+	dev->base->CPSR = div.cpsr;
+	dev->base->CR0 = CR0_DSS(dev->frame_size) | CR0_FRF(FRF_SPI) |
+		CR0_SCR(div.scr);
+	dev->rate = rate;
+
+	return achieved;
+}
+
+uint32_t spi_get_rate(struct spi_dev *dev)
+{
+	return dev->rate;
+}
+
+void spi_set_priority(struct spi_dev *dev, uint32_t priority)
+{
+	NVIC_SetPriority(dev->irq, priority);
+}
+
+/* Write as much as we can (or should) into the TX FIFO */
+static void spi_fill(struct spi_dev *dev)
+{
+	LPC_SSPx_Type *base = dev->base;
+	bool wide = dev->frame_size > FRAMESZ_8BIT;
+
+	while (dev->tx_len && (base->SR & SR_TNF)) {
+		/*
+		 * When receiving, never have more than a FIFO's worth in
+		 * flight, or the RX FIFO could overflow
+		 */
+		if (dev->rx_data && (dev->rx_len - dev->tx_len >= SSP_FIFO_SIZE))
+			break;
+
+		if (!dev->tx_data) {
+			base->DR = 0;
+		} else if (wide) {
+			/* Apparently I can't do this in one go */
+			base->DR = *(const uint16_t *)dev->tx_data;
+			dev->tx_data = (const uint16_t *)dev->tx_data + 1;
 		} else {
-			LPC_SSP0->DR = 0;
+			base->DR = *(const uint8_t *)dev->tx_data;
+			dev->tx_data = (const uint8_t *)dev->tx_data + 1;
 		}
+		dev->tx_len--;
+	}
+}
 
-		if (!len || (++i == SSP_FIFO_SIZE)) {
-			/* Wait for transfer and drain the RX FIFO */
-			while (LPC_SSP0->SR & SR_BSY);
-			while (LPC_SSP0->SR & SR_RNE) {
-				if (rx_data) {
-					if (dev->frame_size > FRAMESZ_8BIT) {
-						*(uint16_t *)rx_data = LPC_SSP0->DR;
-						rx_data = (uint16_t *)rx_data + 1;
-					} else {
-						*(uint8_t *)rx_data = LPC_SSP0->DR;
-						rx_data = (uint8_t *)rx_data + 1;
-					}
-				} else {
-					/* Useless read to drain the FIFO */
-					i = LPC_SSP0->DR;
-				}
-			}
-			i = 0;
+static void spi_drain(struct spi_dev *dev)
+{
+	LPC_SSPx_Type *base = dev->base;
+	bool wide = dev->frame_size > FRAMESZ_8BIT;
+
+	while (dev->rx_len && (base->SR & SR_RNE)) {
+		if (wide) {
+			*(uint16_t *)dev->rx_data = base->DR;
+			dev->rx_data = (uint16_t *)dev->rx_data + 1;
+		} else {
+			*(uint8_t *)dev->rx_data = base->DR;
+			dev->rx_data = (uint8_t *)dev->rx_data + 1;
 		}
+		dev->rx_len--;
+	}
+}
+
+static void spi_complete(struct spi_dev *dev)
+{
+	dev->base->IMSC = 0;
+	dev->busy = false;
+
+	/* The callback is allowed to start a new transfer */
+	if (dev->callback)
+		dev->callback(dev, dev->cb_arg);
+}
+
+static void spi_irq(struct spi_dev *dev)
+{
+	LPC_SSPx_Type *base = dev->base;
+
+	base->ICR = IRQ_RT;
+	if (dev->rx_data)
+		spi_drain(dev);
+	spi_fill(dev);
+
+	if (dev->tx_len || dev->rx_len)
+		return;
+
+	spi_complete(dev);
+}
+
+void SSP0_Handler(void)
+{
+	ISR_STATS_ENTER();
+	spi_irq(&spi_devices[SSP0]);
+	ISR_STATS_EXIT(ISR_SSP);
+}
+
+void SSP1_Handler(void)
+{
+	ISR_STATS_ENTER();
+	spi_irq(&spi_devices[SSP1]);
+	ISR_STATS_EXIT(ISR_SSP);
+}
+
+int spi_transfer_async(struct spi_dev *dev, const void *tx_data, void *rx_data,
+		size_t len, spi_callback callback, void *arg)
+{
+	LPC_SSPx_Type *base = dev->base;
+
+	if (dev->busy)
+		return -1;
+
+	/* A previous TX-only transfer may still be shifting out */
+	while (base->SR & SR_BSY);
+
+	/* Throw away anything left over from TX-only transfers */
+	while (base->SR & SR_RNE)
+		(void)base->DR;
+	base->ICR = IRQ_OR | IRQ_RT;
+
+	dev->tx_data = tx_data;
+	dev->rx_data = rx_data;
+	dev->tx_len = len;
+	dev->rx_len = rx_data ? len : 0;
+	dev->callback = callback;
+	dev->cb_arg = arg;
+	dev->busy = true;
+
+	if (!len) {
+		spi_complete(dev);
+		return 0;
 	}
+
+	/*
+	 * When receiving, the RX interrupts pace the transfer, as there can
+	 * only be a FIFO's worth in flight. Otherwise, just keep the TX FIFO
+	 * topped up.
+	 */
+	spi_fill(dev);
+	if (rx_data)
+		base->IMSC = IRQ_RX | IRQ_RT;
+	else
+		base->IMSC = IRQ_TX;
+
+	return 0;
+}
+
+bool spi_busy(struct spi_dev *dev)
+{
+	return dev->busy || (dev->base->SR & SR_BSY);
+}
+
+void spi_wait(struct spi_dev *dev)
+{
+	while (spi_busy(dev));
+}
+
+void spi_transfer(struct spi_dev *dev, const void *tx_data, void *rx_data,
+		size_t len)
+{
+	spi_wait(dev);
+	spi_transfer_async(dev, tx_data, rx_data, len, NULL, NULL);
+	spi_wait(dev);
 }
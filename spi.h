@@ -24,13 +24,15 @@
 #ifndef __SPI_H__
 #define __SPI_H__
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "LPC11Uxx.h"
 
 enum ssp_select {
 	SSP0 = 0,
-	/* TODO: SSP1, */
+	SSP1 = 1,
 };
 
 enum spi_framesz {
@@ -49,12 +51,47 @@ enum spi_framesz {
 	FRAMESZ_16BIT = 0xF,
 };
 
+/* Bit rate set up by spi_init() */
+#define SPI_DEFAULT_RATE 1000000
+
 struct spi_dev;
 
+struct spi_dividers {
+	uint8_t clkdiv;
+	uint8_t cpsr;
+	uint8_t scr;
+};
+
 /* Initialise the SSP
  */
 struct spi_dev *spi_init(enum ssp_select devno, enum spi_framesz framesz);
 
+/* Work out the SSP clock dividers for a bit rate
+ *
+ * Finds the SSPnCLKDIV, CPSR and SCR values which give the fastest rate
+ * not above "rate", given a main clock of "pclk" Hz.
+ * Returns the achieved rate in Hz, or -1 if "rate" can't be reached.
+ */
+int spi_calc_dividers(uint32_t pclk, uint32_t rate, struct spi_dividers *div);
+
+/* Set the bus bit rate
+ *
+ * Programs the dividers for the fastest rate not above "rate" with the
+ * current clock setup, waiting for any transfer in progress to finish first.
+ * Returns the achieved rate in Hz, or 0 if "rate" is too slow.
+ * The requested rate is remembered, so it can be re-applied if the system
+ * clock changes.
+ */
+uint32_t spi_set_rate(struct spi_dev *dev, uint32_t rate);
+
+/* Return the last rate requested with spi_set_rate() */
+uint32_t spi_get_rate(struct spi_dev *dev);
+
+/* Set the interrupt priority used for background transfers (default 1) */
+void spi_set_priority(struct spi_dev *dev, uint32_t priority);
+
+typedef void (*spi_callback)(struct spi_dev *dev, void *arg);
+
 /* Transfer data over the bus
  *
  * Transfer "len" frames. If tx_data is not NULL, then this will be clocked out
@@ -66,7 +103,29 @@ struct spi_dev *spi_init(enum ssp_select devno, enum spi_framesz framesz);
  *  <= 16 bits: uint16_t
  * N.B. The data should be right-aligned.
  */
-void spi_transfer(struct spi_dev *dev, void *tx_data, void *rx_data,
+void spi_transfer(struct spi_dev *dev, const void *tx_data, void *rx_data,
 		size_t len);
 
+/* Start a transfer in the background
+ *
+ * As spi_transfer(), but returns immediately. The FIFO is refilled from the
+ * SSP interrupt, and "callback" (if not NULL) is called from interrupt
+ * context when the transfer is finished. It may start another transfer.
+ * tx_data and rx_data must remain valid until then.
+ *
+ * If rx_data is NULL, the received data is ignored entirely, and the
+ * transfer is "finished" as soon as the last frame has been queued - the
+ * final few frames may still be shifting out when the callback runs.
+ *
+ * Returns -1 if a transfer is already in progress.
+ */
+int spi_transfer_async(struct spi_dev *dev, const void *tx_data, void *rx_data,
+		size_t len, spi_callback callback, void *arg);
+
+/* Return "true" if a transfer is in progress, or the bus is still active */
+bool spi_busy(struct spi_dev *dev);
+
+/* Wait for any transfer to finish, and the bus to go idle */
+void spi_wait(struct spi_dev *dev);
+
 #endif /* __SPI_H__ */
@@ -2,6 +2,9 @@
 
 /* Addresses pulled in from the linker script */
 extern uint32_t _end_stack;
+extern uint32_t _start_ramfunc_flash;
+extern uint32_t _start_ramfunc;
+extern uint32_t _end_ramfunc;
 extern uint32_t _start_data_flash;
 extern uint32_t _start_data;
 extern uint32_t _end_data;
@@ -50,7 +53,7 @@ void WDT_Handler(void) WEAK_ALIAS(Dummy_Handler);
 void BOD_Handler(void) WEAK_ALIAS(Dummy_Handler);
 void EINT3_Handler(void) WEAK_ALIAS(Dummy_Handler);
 void EINT2_Handler(void) WEAK_ALIAS(Dummy_Handler);
-void EINT1_Handler(void) WEAK_ALIAS(Dummy_Handler);
+void USBWakeup_Handler(void) WEAK_ALIAS(Dummy_Handler);
 void EINT0_Handler(void) WEAK_ALIAS(Dummy_Handler);
 
 void Dummy_Handler(void);
@@ -105,24 +108,30 @@ void *vector_table[] __attribute__ ((section(".vectors"))) = {
     Dummy_Handler,  /* Reserved */
     EINT3_Handler,
     EINT2_Handler,
-    EINT1_Handler,
+    USBWakeup_Handler,
     EINT0_Handler,
 };
 
 void Reset_Handler(void) {
-    uint8_t *src, *dst;
+    uint32_t *src, *dst;
 
-    /* Copy with byte pointers to obviate unaligned access problems */
+    /* The linker script word-aligns the start and end of each section */
+
+    /* Copy RAM functions from Flash to RAM */
+    src = &_start_ramfunc_flash;
+    dst = &_start_ramfunc;
+    while (dst < &_end_ramfunc)
+        *dst++ = *src++;
 
     /* Copy data section from Flash to RAM */
-    src = (uint8_t *)&_start_data_flash;
-    dst = (uint8_t *)&_start_data;
-    while (dst < (uint8_t *)&_end_data)
+    src = &_start_data_flash;
+    dst = &_start_data;
+    while (dst < &_end_data)
         *dst++ = *src++;
 
     /* Clear the bss section */
-    dst = (uint8_t *)&_start_bss;
-    while (dst < (uint8_t *)&_end_bss)
+    dst = &_start_bss;
+    while (dst < &_end_bss)
         *dst++ = 0;
 
     main();
@@ -0,0 +1,33 @@
+/*
+ * Minimal harness for the host-side unit tests ("make test")
+ *
+ * Each test is a standalone program. CHECK() reports a failure and
+ * carries on, and test_exit() gives the exit status for main().
+ */
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+
+static int test_checks;
+static int test_failures;
+
+#define CHECK(_cond, ...) do {                                      \
+	test_checks++;                                              \
+	if (!(_cond)) {                                             \
+		test_failures++;                                    \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed: ",        \
+				__FILE__, __LINE__, #_cond);        \
+		fprintf(stderr, __VA_ARGS__);                       \
+		fputc('\n', stderr);                                \
+	}                                                           \
+} while (0)
+
+static inline int test_exit(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+
+	return test_failures ? 1 : 0;
+}
+
+#endif /* __TEST_H__ */
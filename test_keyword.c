@@ -0,0 +1,114 @@
+/*
+ * Host test for the keyword lookup
+ *
+ * Checks every keyword in the console's tables is found, then throws
+ * random tables and random tokens at it: every entry must be found where
+ * it is, and nothing else may match.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyword.h"
+#include "test.h"
+
+struct entry {
+	const char *name;
+	int value;
+};
+
+/* The command and setting keywords, from main.c, in one table */
+static const char *const console[] = {
+	"RESET", "ID", "SET", "GET", "UPDATE", "COLOUR", "BOOT", "STATS",
+	"PROFILE", "TIME", "BREAKFAST", "LUNCH", "HOME", "DINNER", "BED",
+	"SLEEP", "NEARLY", "PAST", "BRIGHTNESS", "AMBIENT", "NIGHT",
+	"TELEMETRY",
+};
+
+static void random_name(char *buf, int max)
+{
+	int len = rand() % max;
+	int i;
+
+	/* Anything but NUL, including what a noisy line might send */
+	for (i = 0; i < len; i++)
+		buf[i] = (rand() % 255) + 1;
+	buf[len] = '\0';
+}
+
+static void test_console(void)
+{
+	struct keyword_index idx = KEYWORD_INDEX(console);
+	char buf[16];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(console) / sizeof(console[0]); i++) {
+		CHECK(keyword_find(&idx, console[i]) == (int)i,
+				"%s not found", console[i]);
+
+		/* Prefixes and near misses mustn't match */
+		strcpy(buf, console[i]);
+		buf[strlen(buf) - 1] = '\0';
+		CHECK(keyword_find(&idx, buf) == -1, "'%s' matched", buf);
+		strcpy(buf, console[i]);
+		strcat(buf, "X");
+		CHECK(keyword_find(&idx, buf) == -1, "'%s' matched", buf);
+	}
+
+	CHECK(keyword_find(&idx, "") == -1, "empty token matched");
+	CHECK(keyword_find(&idx, "set") == -1, "lower case matched");
+}
+
+static void test_random(void)
+{
+	static char names[KEYWORD_SLOTS - 1][12];
+	struct entry table[KEYWORD_SLOTS - 1];
+	char buf[12];
+	int round, n, i, j, found;
+
+	for (round = 0; round < 2000; round++) {
+		struct keyword_index idx = {
+			.table = table,
+			.stride = sizeof(table[0]),
+		};
+
+		/* Up to a full index, with no duplicates */
+		n = rand() % KEYWORD_SLOTS;
+		for (i = 0; i < n; i++) {
+			do {
+				random_name(names[i], sizeof(names[i]) - 1);
+				for (j = 0; j < i; j++)
+					if (!strcmp(names[i], names[j]))
+						break;
+			} while (j < i);
+			table[i].name = names[i];
+			table[i].value = i;
+		}
+		idx.n = n;
+
+		for (i = 0; i < n; i++) {
+			found = keyword_find(&idx, names[i]);
+			CHECK((found == i) && (table[found].value == i),
+					"round %d: entry %d found at %d",
+					round, i, found);
+		}
+
+		for (i = 0; i < 100; i++) {
+			random_name(buf, sizeof(buf) - 1);
+			found = keyword_find(&idx, buf);
+			CHECK((found == -1) || !strcmp(buf, names[found]),
+					"round %d: false match on entry %d",
+					round, found);
+		}
+	}
+}
+
+int main(void)
+{
+	srand(1);
+
+	test_console();
+	test_random();
+
+	return test_exit("test_keyword");
+}
@@ -0,0 +1,81 @@
+/*
+ * Host test for spi_calc_dividers()
+ *
+ * Sweeps the rate for each of the main clocks we can run from (and a few
+ * odd ones), checking the dividers are legal and the rate they give is
+ * the one returned, and never above the one asked for.
+ */
+#include <stdint.h>
+
+#include "spi.h"
+#include "test.h"
+
+/* spi.c wants this, though nothing here touches the hardware */
+uint32_t SystemCoreClock = 48000000;
+
+static const uint32_t pclks[] = {
+	48000000, 24000000, 12000000, 11059200, 1000000,
+};
+
+static void check_rate(uint32_t pclk, uint32_t rate)
+{
+	struct spi_dividers div = { 0 };
+	uint32_t total;
+	int ret;
+
+	ret = spi_calc_dividers(pclk, rate, &div);
+
+	/* The largest total divider is 255 * 254 * 256 */
+	if (rate < (pclk + 16581119) / 16581120) {
+		CHECK(ret == -1, "%u Hz from %u Hz should fail, got %d",
+				rate, pclk, ret);
+		return;
+	}
+
+	CHECK(ret > 0, "%u Hz from %u Hz failed", rate, pclk);
+	if (ret <= 0)
+		return;
+
+	CHECK((uint32_t)ret <= rate, "asked for %u Hz from %u Hz, got %d",
+			rate, pclk, ret);
+	CHECK((div.cpsr >= 2) && (div.cpsr <= 254) && !(div.cpsr & 1),
+			"bad CPSR %u", div.cpsr);
+	CHECK(div.clkdiv >= 1, "bad CLKDIV %u", div.clkdiv);
+	/* SCR is 8 bits, so 0..255 is all it can hold */
+
+	total = div.clkdiv * div.cpsr * (div.scr + 1);
+	CHECK(pclk / total == (uint32_t)ret,
+			"%u Hz from %u Hz: dividers give %u, returned %d",
+			rate, pclk, pclk / total, ret);
+
+	/* An even divider of pclk must be hit exactly */
+	if (!(pclk % rate) && !((pclk / rate) & 1))
+		CHECK((uint32_t)ret == rate, "%u Hz from %u Hz: got %d",
+				rate, pclk, ret);
+}
+
+int main(void)
+{
+	struct spi_dividers div;
+	uint32_t rate;
+	unsigned int i;
+
+	CHECK(spi_calc_dividers(48000000, 0, &div) == -1, "0 Hz didn't fail");
+
+	for (i = 0; i < sizeof(pclks) / sizeof(pclks[0]); i++) {
+		for (rate = 1; rate < pclks[i] * 2; rate += rate / 16 + 1)
+			check_rate(pclks[i], rate);
+
+		/* The fastest the SSP can go is pclk / 2 */
+		CHECK(spi_calc_dividers(pclks[i], pclks[i], &div) ==
+				(int)(pclks[i] / 2), "max rate from %u Hz",
+				pclks[i]);
+	}
+
+	/* The rates the strips use */
+	check_rate(48000000, 2400000);
+	check_rate(48000000, SPI_DEFAULT_RATE);
+	check_rate(12000000, 2400000);
+
+	return test_exit("test_spi");
+}
@@ -0,0 +1,69 @@
+/*
+ * Host test for the WS2812 encoder
+ *
+ * Packs every value into each colour component, decodes the frame
+ * the way a strip would, and checks that the same colour comes back.
+ */
+#include <stdint.h>
+
+#include "test.h"
+#include "ws2812.h"
+
+/* spi.c wants this, though nothing here touches the hardware */
+uint32_t SystemCoreClock = 48000000;
+
+/*
+ * Decode one LED's worth of frame words back to 0x00GGRRBB, checking
+ * that every 3-bit symbol is a valid 0 (100) or 1 (110).
+ */
+static uint32_t decode(const uint16_t *frame)
+{
+	uint32_t color = 0;
+	int i, j;
+
+	for (i = 0; i < WS2812_WORDS_PER_LED; i++) {
+		for (j = 3; j >= 0; j--) {
+			uint16_t sym = (frame[i] >> (j * 3)) & 0x7;
+
+			CHECK((sym == 0x4) || (sym == 0x6),
+					"word %d has bad symbol %x", i, sym);
+			color = (color << 1) | (sym == 0x6);
+		}
+	}
+
+	return color;
+}
+
+int main(void)
+{
+	uint16_t frame[WS2812_FRAME_SIZE(3)];
+	uint32_t colors[3], got;
+	int val, shift, len, i;
+
+	for (shift = 0; shift < 24; shift += 8) {
+		/* Components are 7 bits, going out as the top 7 of 8 */
+		for (val = 0; val < 0x80; val++) {
+			uint32_t color = (uint32_t)val << shift;
+
+			colors[0] = color;
+			colors[1] = ~color & 0x7f7f7f;
+			colors[2] = color;
+
+			len = ws2812_pack(frame, colors, 3);
+			CHECK(len == WS2812_FRAME_SIZE(3), "packed %d words", len);
+			CHECK(frame[len - 1] == 0, "frame not left low");
+
+			for (i = 0; i < 3; i++) {
+				got = decode(&frame[i * WS2812_WORDS_PER_LED]);
+				CHECK(got == colors[i] << 1,
+						"LED %d: sent %06x, got %06x",
+						i, colors[i] << 1, got);
+			}
+		}
+	}
+
+	CHECK(ws2812_rate_ok(48000000), "can't run from 48 MHz");
+	CHECK(!ws2812_rate_ok(12000000), "12 MHz shouldn't be exact");
+
+	return test_exit("test_ws2812");
+}
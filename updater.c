@@ -0,0 +1,258 @@
+/*
+ * In-application firmware update over the USB serial port
+ *
+ * The new image is received into the staging area in the top half of
+ * flash, and checked. Only then is it copied over the running firmware,
+ * by a routine which runs entirely from RAM.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "LPC11Uxx.h"
+
+#include "iap.h"
+#include "updater.h"
+#include "usb_cdc.h"
+#include "util.h"
+
+/* Give up if the host goes quiet for this long */
+#define UPDATER_TIMEOUT_MS 2000
+/* After a failure, the rest of the image is over once it's this quiet */
+#define UPDATER_DRAIN_MS 100
+
+/* Addresses pulled in from the linker script */
+extern uint32_t _start_staging;
+extern uint32_t _end_staging;
+
+#define STAGING_BASE ((uint32_t)(uintptr_t)&_start_staging)
+#define STAGING_SIZE ((uint32_t)((uintptr_t)&_end_staging - (uintptr_t)&_start_staging))
+
+struct updater {
+	bool active;
+	/* Failed, and discarding the rest of the image */
+	bool failed;
+	uint32_t size;
+	uint32_t crc;
+	uint32_t received;
+	uint32_t last_rx;
+	/* Must be word-aligned for the IAP */
+	uint32_t page[FLASH_PAGE_SIZE / 4];
+};
+
+static struct updater updater;
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+	int i;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+static uint32_t flash_sector(uint32_t addr)
+{
+	return addr / FLASH_SECTOR_SIZE;
+}
+
+static int program_page(uint32_t addr, uint32_t *data)
+{
+	uint32_t sector = flash_sector(addr);
+	int ret = 0;
+
+	__disable_irq();
+	if ((addr % FLASH_SECTOR_SIZE) == 0) {
+		ret = iap_prepare_sectors(sector, sector);
+		if (!ret)
+			ret = iap_erase_sectors(sector, sector);
+	}
+	if (!ret)
+		ret = iap_prepare_sectors(sector, sector);
+	if (!ret)
+		ret = iap_copy_ram_to_flash(addr, data, FLASH_PAGE_SIZE);
+	if (!ret)
+		ret = iap_compare(addr, data, FLASH_PAGE_SIZE);
+	__enable_irq();
+
+	return ret;
+}
+
+/*
+ * Copy the staged image over the running firmware, and reset.
+ * Everything this touches must be in RAM or ROM - including the IAP
+ * wrappers, so the IAP commands are issued directly.
+ */
+static RAMFUNC void updater_commit(uint32_t size)
+{
+	IAP iap = (IAP)IAP_LOCATION;
+	uint32_t cmd[5], res[4];
+	uint32_t cclk = SystemCoreClock / 1000;
+	uint32_t last = (size - 1) / FLASH_SECTOR_SIZE;
+	uint32_t addr, i;
+
+	__disable_irq();
+
+	cmd[0] = 50;
+	cmd[1] = 0;
+	cmd[2] = last;
+	iap(cmd, res);
+	cmd[0] = 52;
+	cmd[3] = cclk;
+	iap(cmd, res);
+
+	for (addr = 0; addr < size; addr += FLASH_PAGE_SIZE) {
+		/*
+		 * volatile, so the compiler can't turn this loop into a call
+		 * to memcpy() - which lives in the flash being erased.
+		 */
+		const volatile uint32_t *src = (const volatile uint32_t *)(STAGING_BASE + addr);
+		volatile uint32_t *dst = updater.page;
+
+		for (i = 0; i < FLASH_PAGE_SIZE / 4; i++) {
+			dst[i] = src[i];
+		}
+
+		cmd[0] = 50;
+		cmd[1] = addr / FLASH_SECTOR_SIZE;
+		cmd[2] = cmd[1];
+		iap(cmd, res);
+
+		cmd[0] = 51;
+		cmd[1] = addr;
+		cmd[2] = (uint32_t)(uintptr_t)updater.page;
+		cmd[3] = FLASH_PAGE_SIZE;
+		cmd[4] = cclk;
+		iap(cmd, res);
+	}
+
+	SCB->AIRCR = (0x5FA << SCB_AIRCR_VECTKEY_Pos) | SCB_AIRCR_SYSRESETREQ_Msk;
+	while (1);
+}
+
+static void updater_finish(int ret)
+{
+	const uint32_t *vector = (const uint32_t *)STAGING_BASE;
+	uint32_t sum = 0;
+	int i;
+
+	if (!ret) {
+		/* The boot ROM won't run an image with a bad vector checksum */
+		for (i = 0; i < 8; i++) {
+			sum += vector[i];
+		}
+		if (sum || (crc32(0, (const uint8_t *)vector, updater.size) != updater.crc)) {
+			ret = -1;
+		}
+	}
+
+	if (ret) {
+		/*
+		 * The host may still have data in flight, or not have noticed
+		 * yet. Stay in update mode to soak it up, so it doesn't get
+		 * taken as commands.
+		 */
+		usb_usart_print("\nERR\r\n");
+		updater.failed = true;
+		return;
+	}
+
+	updater.active = false;
+	usb_usart_print("\nOK\r\n");
+	delay_ms(10);
+	updater_commit(updater.size);
+}
+
+int updater_start(uint32_t size, uint32_t crc)
+{
+	if (!size || (size > STAGING_SIZE)) {
+		return -1;
+	}
+
+	updater.active = true;
+	updater.failed = false;
+	updater.size = size;
+	updater.crc = crc;
+	updater.received = 0;
+	updater.last_rx = msTicks;
+
+	usb_usart_print("\nREADY\r\n");
+
+	return 0;
+}
+
+bool updater_active(void)
+{
+	return updater.active;
+}
+
+/* Throw away the rest of a failed image */
+static void updater_drain(void)
+{
+	uint32_t ret;
+
+	while (updater.received < updater.size) {
+		ret = usb_usart_recv((char *)updater.page, sizeof(updater.page), 0);
+		if (!ret) {
+			if (ms_since(updater.last_rx) <= UPDATER_DRAIN_MS) {
+				return;
+			}
+			break;
+		}
+		updater.last_rx = msTicks;
+		updater.received += ret;
+	}
+
+	usb_usart_flush_rx();
+	updater.active = false;
+}
+
+void updater_poll(void)
+{
+	uint8_t *page = (uint8_t *)updater.page;
+	uint32_t offset, chunk, ret;
+
+	if (updater.failed) {
+		updater_drain();
+		return;
+	}
+
+	while (updater.received < updater.size) {
+		offset = updater.received % FLASH_PAGE_SIZE;
+		chunk = UPDATER_CHUNK_SIZE - (offset % UPDATER_CHUNK_SIZE);
+		if (chunk > updater.size - updater.received) {
+			chunk = updater.size - updater.received;
+		}
+
+		ret = usb_usart_recv((char *)&page[offset], chunk, 0);
+		if (!ret) {
+			if (ms_since(updater.last_rx) > UPDATER_TIMEOUT_MS) {
+				updater_finish(-1);
+			}
+			return;
+		}
+		updater.last_rx = msTicks;
+		updater.received += ret;
+		offset += ret;
+
+		if ((offset == FLASH_PAGE_SIZE) || (updater.received == updater.size)) {
+			memset(&page[offset], 0xff, FLASH_PAGE_SIZE - offset);
+			if (program_page(STAGING_BASE + updater.received - offset, updater.page)) {
+				updater_finish(-1);
+				return;
+			}
+		}
+
+		if (((offset % UPDATER_CHUNK_SIZE) == 0) || (updater.received == updater.size)) {
+			usb_usart_send("k", 1);
+		}
+	}
+
+	updater_finish(0);
+}
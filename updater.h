@@ -0,0 +1,36 @@
+/*
+ * In-application firmware update over the USB serial port
+ */
+#ifndef __UPDATER_H__
+#define __UPDATER_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Start receiving a new firmware image of 'size' bytes, with a CRC-32
+ * (as used by zlib/Ethernet) of 'crc'.
+ * The image should be the checksummed binary, ready for the boot ROM.
+ *
+ * After a successful return, the serial port is taken over by the
+ * updater until the transfer completes or fails:
+ *  - The host sends the image in chunks of UPDATER_CHUNK_SIZE bytes
+ *    (the last may be short), and may have at most UPDATER_WINDOW chunks
+ *    un-acknowledged at any time.
+ *  - Each chunk is acknowledged with a single 'k' once it's been consumed.
+ *  - Once the whole image is received and verified, "\nOK\r\n" is sent and
+ *    the device re-flashes itself and reboots. On any failure, "\nERR\r\n"
+ *    is sent and the old firmware keeps running. The rest of the image
+ *    is then discarded, until 'size' bytes have arrived or the host goes
+ *    quiet.
+ */
+#define UPDATER_CHUNK_SIZE 64
+#define UPDATER_WINDOW     2
+int updater_start(uint32_t size, uint32_t crc);
+
+/* Returns "true" if an update is in progress */
+bool updater_active(void);
+
+/* Call from the main loop to process received data */
+void updater_poll(void);
+
+#endif /* __UPDATER_H__ */
@@ -3,7 +3,9 @@
 
 #include "LPC11Uxx.h"
 
+#include "isr_stats.h"
 #include "util.h"
+#include "usb_cdc.h"
 #include "LPC43XX_USB.h"
 
 #define ALIGN(__x, __to) (((__x) + (__to - 1)) & ~(__to - 1))
@@ -17,7 +19,7 @@
 
 #define USB_MEM_BASE 0x20004000
 #define USB_MEM_SIZE 0x800
-#define USB_NUM_ENDPOINTS 3
+#define USB_NUM_ENDPOINTS 4
 
 #define USB_CDC_CIF_NUM   0
 #define USB_CDC_DIF_NUM   1
@@ -27,6 +29,11 @@
 #define USB_CDC_EP_BULK_OUT  USB_ENDPOINT_OUT(USB_CDC_EP_DIF)
 #define USB_CDC_EP_INT_IN    USB_ENDPOINT_IN(USB_CDC_EP_CIF)
 
+#define USB_VENDOR_IF_NUM 2
+#define USB_VENDOR_EP     3
+#define USB_VENDOR_EP_IN  USB_ENDPOINT_IN(USB_VENDOR_EP)
+#define USB_VENDOR_EP_OUT USB_ENDPOINT_OUT(USB_VENDOR_EP)
+
 #define CDC_NO_CALL_MGMT_FUNC_DESC
 
 #define UNUSED(_x) (void)(_x)
@@ -46,6 +53,17 @@ struct usb_ctx {
 	volatile uint8_t *volatile rx_head;
 	volatile uint8_t *volatile rx_tail;
 	volatile size_t rx_len;
+
+	/*
+	 * The vendor OUT endpoint is only read when the application asks
+	 * for a packet, so until then the hardware NAKs the host.
+	 */
+	volatile bool vendor_rx_pending;
+	volatile bool vendor_tx_busy;
+
+	volatile bool suspended;
+	volatile bool clk_gated;
+	volatile bool remote_wakeup;
 };
 
 struct usb_ctx usb_ctx;
@@ -54,9 +72,10 @@ const USB_DEVICE_DESCRIPTOR device_descriptor = {
 	.bLength = USB_DEVICE_DESC_SIZE,
 	.bDescriptorType = USB_DEVICE_DESCRIPTOR_TYPE,
 	.bcdUSB = 0x200,
-	.bDeviceClass = USB_DEVICE_CLASS_COMMUNICATIONS,
-	.bDeviceSubClass = 0,
-	.bDeviceProtocol = 0,
+	/* Composite device using Interface Association Descriptors */
+	.bDeviceClass = USB_DEVICE_CLASS_MISCELLANEOUS,
+	.bDeviceSubClass = 0x02,
+	.bDeviceProtocol = 0x01,
 	.bMaxPacketSize0 = USB_MAX_PACKET0,
 	/* pid.codes test code: http://pid.codes/1209/0001/ */
 	.idVendor = 0x1209,
@@ -103,8 +122,8 @@ struct __attribute__((packed)) cdc_cif_descriptor {
 	 *
 	 * More info: https://www.lpcware.com/content/forum/usbd-get-device-configuration-descriptor-truncated-packets
 	 *
-	 * TODO: It should be possible to override the GetDescriptor
-	 * Config request, and possibly work-around this limitation.
+	 * The full descriptor is now larger than one packet anyway (see
+	 * EP0_Hdlr()), but there's still no need for this one.
 	 */
 	USB_CDC_CM_FUNC_DESC func_cm;
 #endif
@@ -119,10 +138,29 @@ struct __attribute__((packed)) cdc_dif_descriptor {
 	USB_ENDPOINT_DESCRIPTOR ep_in;
 };
 
+struct __attribute__((packed)) iad_descriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bFirstInterface;
+	uint8_t bInterfaceCount;
+	uint8_t bFunctionClass;
+	uint8_t bFunctionSubClass;
+	uint8_t bFunctionProtocol;
+	uint8_t iFunction;
+};
+
+struct __attribute__((packed)) vendor_descriptor {
+	USB_INTERFACE_DESCRIPTOR intf;
+	USB_ENDPOINT_DESCRIPTOR ep_out;
+	USB_ENDPOINT_DESCRIPTOR ep_in;
+};
+
 struct __attribute__((packed)) cdc_descriptor_array {
 	USB_CONFIGURATION_DESCRIPTOR cfg;
+	struct iad_descriptor iad;
 	struct cdc_cif_descriptor cif;
 	struct cdc_dif_descriptor dif;
+	struct vendor_descriptor vendor;
 	uint8_t null;
 };
 
@@ -131,12 +169,22 @@ const struct cdc_descriptor_array desc_array = {
 		.bLength = USB_CONFIGURATION_DESC_SIZE,
 		.bDescriptorType = USB_CONFIGURATION_DESCRIPTOR_TYPE,
 		.wTotalLength = sizeof(struct cdc_descriptor_array) - 1,
-		.bNumInterfaces = 0x02,
+		.bNumInterfaces = 0x03,
 		.bConfigurationValue = 0x01,
 		.iConfiguration = 0,
-		.bmAttributes = USB_CONFIG_BUS_POWERED,
+		.bmAttributes = USB_CONFIG_BUS_POWERED | USB_CONFIG_REMOTE_WAKEUP,
 		.bMaxPower = USB_CONFIG_POWER_MA(100),
 	},
+	.iad = {
+		.bLength = sizeof(struct iad_descriptor),
+		.bDescriptorType = USB_INTERFACE_ASSOCIATION_DESCRIPTOR_TYPE,
+		.bFirstInterface = USB_CDC_CIF_NUM,
+		.bInterfaceCount = 2,
+		.bFunctionClass = CDC_COMMUNICATION_INTERFACE_CLASS,
+		.bFunctionSubClass = CDC_ABSTRACT_CONTROL_MODEL,
+		.bFunctionProtocol = 0,
+		.iFunction = 0,
+	},
 	.cif = {
 		.intf = {
 			.bLength = USB_INTERFACE_DESC_SIZE,
@@ -215,6 +263,35 @@ const struct cdc_descriptor_array desc_array = {
 			.bInterval = 0,
 		},
 	},
+	.vendor = {
+		.intf = {
+			.bLength = USB_INTERFACE_DESC_SIZE,
+			.bDescriptorType = USB_INTERFACE_DESCRIPTOR_TYPE,
+			.bInterfaceNumber = USB_VENDOR_IF_NUM,
+			.bAlternateSetting = 0,
+			.bNumEndpoints = 0x2,
+			.bInterfaceClass = USB_DEVICE_CLASS_VENDOR_SPECIFIC,
+			.bInterfaceSubClass = 0,
+			.bInterfaceProtocol = 0,
+			.iInterface = 0,
+		},
+		.ep_out = {
+			.bLength = USB_ENDPOINT_DESC_SIZE,
+			.bDescriptorType = USB_ENDPOINT_DESCRIPTOR_TYPE,
+			.bEndpointAddress = USB_VENDOR_EP_OUT,
+			.bmAttributes = USB_ENDPOINT_TYPE_BULK,
+			.wMaxPacketSize = USB_VENDOR_PACKET_SIZE,
+			.bInterval = 0,
+		},
+		.ep_in = {
+			.bLength = USB_ENDPOINT_DESC_SIZE,
+			.bDescriptorType = USB_ENDPOINT_DESCRIPTOR_TYPE,
+			.bEndpointAddress = USB_VENDOR_EP_IN,
+			.bmAttributes = USB_ENDPOINT_TYPE_BULK,
+			.wMaxPacketSize = USB_VENDOR_PACKET_SIZE,
+			.bInterval = 0,
+		},
+	},
 	.null = 0,
 };
 
@@ -297,6 +374,61 @@ ErrorCode_t CDC_BulkOUT_Hdlr(USBD_HANDLE_T hUsb, void* data,
 	return LPC_OK;
 }
 
+/*
+ * The ROM driver truncates configuration descriptors longer than one
+ * control packet, which ours now is. Class handlers get to see EP0 setup
+ * requests before the ROM's standard request handling, so we answer
+ * GET_DESCRIPTOR(CONFIG) ourselves by pointing the EP0 data stage at the
+ * whole descriptor. The ROM's DataInStage() then handles splitting it
+ * into packets (and the ZLP) correctly.
+ */
+ErrorCode_t EP0_Hdlr(USBD_HANDLE_T hUsb, void* data, uint32_t event)
+{
+	USB_CORE_CTRL_T *ctrl = (USB_CORE_CTRL_T *)hUsb;
+	USBD_SETUP_PACKET *setup = &ctrl->SetupPacket;
+	uint16_t len = desc_array.cfg.wTotalLength;
+	UNUSED(data);
+
+	if (event != USB_EVT_SETUP)
+		return ERR_USBD_UNHANDLED;
+
+	if ((setup->bmRequestType.B != 0x80) ||
+	    (setup->bRequest != USB_REQUEST_GET_DESCRIPTOR) ||
+	    (setup->wValue.WB.H != USB_CONFIGURATION_DESCRIPTOR_TYPE))
+		return ERR_USBD_UNHANDLED;
+
+	if (setup->wLength < len)
+		len = setup->wLength;
+
+	ctrl->EP0Data.pData = (uint8_t *)(uintptr_t)&desc_array.cfg;
+	ctrl->EP0Data.Count = len;
+	USBD_DataInStage(hUsb);
+
+	return LPC_OK;
+}
+
+ErrorCode_t Vendor_BulkIN_Hdlr(USBD_HANDLE_T hUsb, void* data, uint32_t event)
+{
+	UNUSED(hUsb);
+	UNUSED(data);
+
+	if (event == USB_EVT_IN)
+		usb_ctx.vendor_tx_busy = false;
+
+	return LPC_OK;
+}
+
+ErrorCode_t Vendor_BulkOUT_Hdlr(USBD_HANDLE_T hUsb, void* data, uint32_t event)
+{
+	UNUSED(hUsb);
+	UNUSED(data);
+
+	if (event == USB_EVT_OUT)
+		usb_ctx.vendor_rx_pending = true;
+
+	return LPC_OK;
+}
+
 ErrorCode_t SetCtrlLineState(USBD_HANDLE_T hCDC, uint16_t state)
 {
 	UNUSED(hCDC);
@@ -318,9 +450,77 @@ ErrorCode_t SendBreak(USBD_HANDLE_T hCDC, uint16_t mstime)
 	return LPC_OK;
 }
 
+/*
+ * Suspend/resume
+ *
+ * On suspend we switch the USB "need clock" wake-up to trigger on a rising
+ * edge, and leave it to usb_suspend_idle() (called from the main loop) to
+ * turn off the USB clocks and PLL once the block no longer needs them.
+ * Bus activity raises USB_NEED_CLK, which fires USBWakeup_Handler() to
+ * bring the clocks back before the USB interrupt gets to run.
+ */
+#define PDRUNCFG_USBPLL   (1 << 8)
+#define USBCLKCTRL_POL    (1 << 1)
+#define USBCLKST_NEED_CLK (1 << 0)
+#define AHBCLK_USB        ((0x1 << 14) | (0x1 << 27))
+
+static void usb_clock_restore(void)
+{
+	if (!usb_ctx.clk_gated)
+		return;
+
+	LPC_SYSCON->PDRUNCFG &= ~PDRUNCFG_USBPLL;
+	while (!(LPC_SYSCON->USBPLLSTAT & 0x01));
+	LPC_SYSCON->SYSAHBCLKCTRL |= AHBCLK_USB;
+	usb_ctx.clk_gated = false;
+}
+
+ErrorCode_t USB_Suspend_Hdlr(USBD_HANDLE_T hUsb)
+{
+	UNUSED(hUsb);
+
+	/* Nobody is going to collect any ongoing transmission */
+	usb_ctx.tx_len = 0;
+	usb_ctx.tx_buf = NULL;
+	usb_ctx.vendor_tx_busy = false;
+
+	usb_ctx.suspended = true;
+	LPC_SYSCON->USBCLKCTRL = USBCLKCTRL_POL;
+	NVIC_ClearPendingIRQ(USBWakeup_IRQn);
+	NVIC_EnableIRQ(USBWakeup_IRQn);
+
+	return LPC_OK;
+}
+
+ErrorCode_t USB_Resume_Hdlr(USBD_HANDLE_T hUsb)
+{
+	UNUSED(hUsb);
+
+	NVIC_DisableIRQ(USBWakeup_IRQn);
+	LPC_SYSCON->USBCLKCTRL = 0;
+	usb_ctx.suspended = false;
+
+	return LPC_OK;
+}
+
+ErrorCode_t USB_WakeUpCfg_Hdlr(USBD_HANDLE_T hUsb, uint32_t param)
+{
+	UNUSED(hUsb);
+	usb_ctx.remote_wakeup = param;
+
+	return LPC_OK;
+}
+
+void USBWakeup_Handler(void)
+{
+	usb_clock_restore();
+}
+
 void USB_Handler(void)
 {
+	ISR_STATS_ENTER();
 	USBD_API->hw->ISR(usb_ctx.core_hnd);
+	ISR_STATS_EXIT(ISR_USB);
 }
 
 void usb_periph_init()
@@ -355,6 +555,9 @@ ErrorCode_t usb_core_init(uint32_t mem_base, uint32_t *mem_size)
 	usb_param.usb_reg_base = LPC_USB_BASE;
 	usb_param.mem_base = mem_base;
 	usb_param.max_num_ep = USB_NUM_ENDPOINTS;
+	usb_param.USB_Suspend_Event = USB_Suspend_Hdlr;
+	usb_param.USB_Resume_Event = USB_Resume_Hdlr;
+	usb_param.USB_WakeUpCfg = USB_WakeUpCfg_Hdlr;
 
 	/*
 	 * The in-ROM MemSize calculation is wrong/limited:
@@ -440,9 +643,28 @@ int usb_init()
 		goto error;
 	}
 
+	ep = USB_EP_INDEX_IN(USB_VENDOR_EP);
+	ret = USBD_RegisterEpHandler(usb_ctx.core_hnd, ep, Vendor_BulkIN_Hdlr, &usb_ctx);
+	if (ret != LPC_OK) {
+		goto error;
+	}
+
+	ep = USB_EP_INDEX_OUT(USB_VENDOR_EP);
+	ret = USBD_RegisterEpHandler(usb_ctx.core_hnd, ep, Vendor_BulkOUT_Hdlr, &usb_ctx);
+	if (ret != LPC_OK) {
+		goto error;
+	}
+
+	ret = USBD_RegisterClassHandler(usb_ctx.core_hnd, EP0_Hdlr, &usb_ctx);
+	if (ret != LPC_OK) {
+		goto error;
+	}
+
 	/* Enable IRQ */
 	NVIC_SetPriority(USB_IRQn, 3);
 	NVIC_EnableIRQ(USB_IRQn);
+	/* Above USB_IRQn, so the clocks are back before the USB ISR runs */
+	NVIC_SetPriority(USBWakeup_IRQn, 2);
 
 	/* Connect to the bus */
 	USBD_Connect(usb_ctx.core_hnd, 1);
@@ -461,12 +683,16 @@ error:
 	return -1;
 }
 
-void usb_usart_send(const char *buf, size_t len)
+int usb_usart_send_async(const char *buf, size_t len)
 {
-	if (!usb_ctx.dtr)
-		return;
+	if (!usb_ctx.dtr || usb_ctx.suspended)
+		return -1;
 
 	NVIC_DisableIRQ(USB_IRQn);
+	if (usb_ctx.tx_buf != NULL) {
+		NVIC_EnableIRQ(USB_IRQn);
+		return -1;
+	}
 	usb_ctx.tx_buf = (const uint8_t *)buf;
 	usb_ctx.tx_len = len;
 	/*
@@ -476,16 +702,37 @@ void usb_usart_send(const char *buf, size_t len)
 	CDC_BulkIN_Hdlr(usb_ctx.core_hnd, &usb_ctx, USB_EVT_IN);
 	NVIC_EnableIRQ(USB_IRQn);
 
-	/* Wait for finish */
+	return 0;
+}
+
+bool usb_usart_tx_busy(void)
+{
+	return usb_ctx.tx_buf != NULL;
+}
+
+void usb_usart_send(const char *buf, size_t len)
+{
+	if (!usb_ctx.dtr || usb_ctx.suspended)
+		return;
+
+	/* Wait for any asynchronous transfer, then for our own */
+	while (usb_usart_send_async(buf, len)) {
+		if (!usb_ctx.dtr || usb_ctx.suspended)
+			return;
+	}
 	while(usb_ctx.tx_buf != NULL);
 }
 
 void usb_usart_print(const char *str)
 {
 	size_t i = 0;
-	while (str[i++]);
 
-	usb_usart_send(str, i);
+	/* Just the characters - a NUL on the wire only confuses the host */
+	while (str[i])
+		i++;
+
+	if (i)
+		usb_usart_send(str, i);
 }
 
 int usb_usart_recv(char *buf, size_t len, int timeout)
@@ -530,3 +777,73 @@ bool usb_usart_dtr(void)
 {
 	return usb_ctx.dtr;
 }
+
+bool usb_vendor_pending(void)
+{
+	return usb_ctx.vendor_rx_pending;
+}
+
+int usb_vendor_recv(uint8_t *buf)
+{
+	uint32_t len;
+
+	if (!usb_ctx.vendor_rx_pending)
+		return 0;
+
+	NVIC_DisableIRQ(USB_IRQn);
+	len = USBD_ReadEP(usb_ctx.core_hnd, USB_VENDOR_EP_OUT, buf);
+	usb_ctx.vendor_rx_pending = false;
+	NVIC_EnableIRQ(USB_IRQn);
+
+	return len;
+}
+
+int usb_vendor_send(const uint8_t *buf, size_t len)
+{
+	if (usb_ctx.vendor_tx_busy || usb_ctx.suspended)
+		return -1;
+
+	if (len > USB_VENDOR_PACKET_SIZE)
+		len = USB_VENDOR_PACKET_SIZE;
+
+	NVIC_DisableIRQ(USB_IRQn);
+	usb_ctx.vendor_tx_busy = true;
+	USBD_WriteEP(usb_ctx.core_hnd, USB_VENDOR_EP_IN,
+		     (uint8_t *)(uintptr_t)buf, len);
+	NVIC_EnableIRQ(USB_IRQn);
+
+	return len;
+}
+
+bool usb_suspended(void)
+{
+	return usb_ctx.suspended;
+}
+
+void usb_suspend_idle(void)
+{
+	if (!usb_ctx.suspended || usb_ctx.clk_gated)
+		return;
+
+	NVIC_DisableIRQ(USBWakeup_IRQn);
+	if (!(LPC_SYSCON->USBCLKST & USBCLKST_NEED_CLK)) {
+		LPC_SYSCON->SYSAHBCLKCTRL &= ~AHBCLK_USB;
+		LPC_SYSCON->PDRUNCFG |= PDRUNCFG_USBPLL;
+		usb_ctx.clk_gated = true;
+	}
+	NVIC_EnableIRQ(USBWakeup_IRQn);
+}
+
+int usb_remote_wakeup(void)
+{
+	if (!usb_ctx.suspended || !usb_ctx.remote_wakeup)
+		return -1;
+
+	NVIC_DisableIRQ(USBWakeup_IRQn);
+	usb_clock_restore();
+	NVIC_EnableIRQ(USBWakeup_IRQn);
+
+	USBD_API->hw->WakeUp(usb_ctx.core_hnd);
+
+	return 0;
+}
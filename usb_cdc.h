@@ -3,6 +3,7 @@
 #define __USB_CDC_H__
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 int usb_init(void);
 
@@ -12,6 +13,17 @@ int usb_init(void);
  */
 void usb_usart_send(const char *buf, size_t len);
 
+/** Start sending the buffer over the USB serial port.
+ *
+ * Doesn't block - 'buf' must remain valid until the transfer completes.
+ * Returns -1 if there's already a transfer in progress, or no host is
+ * connected.
+ */
+int usb_usart_send_async(const char *buf, size_t len);
+
+/* Return "true" if a transfer is still in progress */
+bool usb_usart_tx_busy(void);
+
 /* Send a zero-terminated string */
 void usb_usart_print(const char *str);
 
@@ -32,4 +44,50 @@ void usb_usart_flush_rx(void);
 /* Return "true" if the USB serial port is connected to a host */
 bool usb_usart_dtr(void);
 
+/* Return "true" if the host has suspended the bus */
+bool usb_suspended(void);
+
+/*
+ * Call periodically from the main loop while suspended.
+ * Turns off the USB clocks and PLL once it's safe to do so. They are
+ * turned back on automatically when there is bus activity.
+ */
+void usb_suspend_idle(void);
+
+/*
+ * Ask the host to resume the bus.
+ * Returns -1 if we're not suspended, or the host hasn't enabled remote
+ * wake-up.
+ */
+int usb_remote_wakeup(void);
+
+/*
+ * Vendor-specific interface
+ *
+ * A pair of bulk endpoints alongside the CDC interfaces, for low-latency
+ * control without going through the host's tty layer. Transfers are
+ * single packets of up to USB_VENDOR_PACKET_SIZE bytes.
+ */
+#define USB_VENDOR_PACKET_SIZE 64
+
+/* Return "true" if a packet is waiting to be read by usb_vendor_recv() */
+bool usb_vendor_pending(void);
+
+/** Receive a packet from the vendor interface.
+ *
+ * 'buf' must have room for USB_VENDOR_PACKET_SIZE bytes.
+ * Doesn't block. Returns the number of bytes received (0 if there was no
+ * packet waiting).
+ * The host is NAKed until the pending packet has been read.
+ */
+int usb_vendor_recv(uint8_t *buf);
+
+/** Send a packet on the vendor interface.
+ *
+ * Doesn't block - 'buf' must remain valid until the transfer completes.
+ * Returns the number of bytes queued, or -1 if the previous packet hasn't
+ * been collected by the host yet.
+ */
+int usb_vendor_send(const uint8_t *buf, size_t len);
+
 #endif /* __USB_CDC_H__ */
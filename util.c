@@ -24,13 +24,18 @@
 
 #include <stdint.h>
 
+#include "LPC11Uxx.h"
+
 #include "usart.h"
 #include "util.h"
 
 volatile uint32_t msTicks = 0;
+/* Cycles in all the completed ticks, which vary with the core clock */
+static volatile uint32_t tick_cycles = 0;
 
 void SysTick_Handler(void) {
 	msTicks++;
+	tick_cycles += SysTick->LOAD + 1;
 }
 
 void delay_ms(uint32_t ms) {
@@ -38,6 +43,49 @@ void delay_ms(uint32_t ms) {
 	while ((msTicks-now) < ms);
 }
 
+uint32_t ms_since(uint32_t since)
+{
+	uint32_t now = msTicks;
+	if (now < since) {
+		return now + (0xffffffff - since) + 1;
+	}
+
+	return now - since;
+}
+
+RAMFUNC uint32_t lerp(uint32_t from, uint32_t to, uint32_t pos, uint32_t max)
+{
+	int32_t diff = to - from;
+	uint32_t x = (pos << 16) / max;
+
+	if (pos >= max) {
+		return to;
+	}
+
+	return from + ((diff * x) / 65536);
+}
+
+RAMFUNC uint32_t slew(uint32_t from, uint32_t to, uint32_t step)
+{
+	if (to > from)
+		return (to - from > step) ? from + step : to;
+
+	return (from - to > step) ? from - step : to;
+}
+
+uint32_t cycle_count(void)
+{
+	uint32_t base, val;
+
+	/* Re-read if SysTick wrapped in between reading the two */
+	do {
+		base = tick_cycles;
+		val = SysTick->VAL;
+	} while (base != tick_cycles);
+
+	return base + (SysTick->LOAD - val);
+}
+
 void set_with_mask(volatile uint32_t *reg, uint32_t mask, uint32_t val)
 {
 	*reg &= ~mask;
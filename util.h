@@ -27,11 +27,41 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+/*
+ * Run a function from SRAM, which has no wait states (flash needs some at
+ * 48 MHz). These are copied to SRAM by Reset_Handler. SRAM is out of range
+ * of a normal branch from flash, hence long_call.
+ */
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline, long_call))
+
+/*
+ * Stop the compiler moving memory accesses across this point. That's all
+ * the ordering a single Cortex-M0 core needs between an interrupt and
+ * the main loop (the CMSIS __DMB() here doesn't clobber memory).
+ */
+#define barrier() __asm volatile("" ::: "memory")
+
 /* SysTick counter */
 extern volatile uint32_t msTicks;
 
 void delay_ms(uint32_t ms);
 
+/* Milliseconds elapsed since the msTicks value 'since' */
+uint32_t ms_since(uint32_t since);
+
+/* Linear interpolation from 'from' to 'to', 'pos' of the way to 'max' */
+RAMFUNC uint32_t lerp(uint32_t from, uint32_t to, uint32_t pos, uint32_t max);
+
+/* Move from 'from' towards 'to', by at most 'step' */
+RAMFUNC uint32_t slew(uint32_t from, uint32_t to, uint32_t step);
+
+/*
+ * Free-running CPU cycle counter, built from SysTick. Keeps counting
+ * cycles across clock_set(), as each tick adds its own length.
+ * Wraps every 2^32 cycles, so only use it for differences.
+ */
+uint32_t cycle_count(void);
+
 void set_with_mask(volatile uint32_t *reg, uint32_t mask, uint32_t val);
 
 #endif /* __UTIL_H__ */
@@ -0,0 +1,61 @@
+/* Basic WS2812/SK6812 Interface
+ *
+ * See ws2812.h for how the SSP is used.
+ */
+#include "ws2812.h"
+
+/* 12-bit SSP frame for each nibble, MSB first */
+static const uint16_t symbols[16] = {
+	0x924, 0x926, 0x934, 0x936, 0x9a4, 0x9a6, 0x9b4, 0x9b6,
+	0xd24, 0xd26, 0xd34, 0xd36, 0xda4, 0xda6, 0xdb4, 0xdb6,
+};
+
+void ws2812_init(struct spi_dev *dev)
+{
+	spi_set_rate(dev, WS2812_SPI_RATE);
+	spi_set_priority(dev, 0);
+}
+
+bool ws2812_rate_ok(uint32_t pclk)
+{
+	struct spi_dividers div;
+
+	return spi_calc_dividers(pclk, WS2812_SPI_RATE, &div) == WS2812_SPI_RATE;
+}
+
+int ws2812_pack(uint16_t *frame, const uint32_t *colors, int n_leds)
+{
+	uint16_t *p = frame;
+
+	/* Wire order is G, R, B - the same as the framebuffer */
+	while (n_leds--) {
+		/* 7 bits per component to 8 */
+		uint32_t color = *colors++ << 1;
+
+		*p++ = symbols[(color >> 20) & 0xf];
+		*p++ = symbols[(color >> 16) & 0xf];
+		*p++ = symbols[(color >> 12) & 0xf];
+		*p++ = symbols[(color >> 8) & 0xf];
+		*p++ = symbols[(color >> 4) & 0xf];
+		*p++ = symbols[color & 0xf];
+	}
+
+	/* Leave the line low */
+	*p++ = 0;
+
+	return p - frame;
+}
+
+void ws2812_send(struct spi_dev *dev, const uint16_t *frame, int len)
+{
+	spi_wait(dev);
+	spi_transfer_async(dev, frame, NULL, len, NULL, NULL);
+}
+
+void ws2812_update(struct spi_dev *dev, uint16_t *frame, const uint32_t *colors,
+		int n_leds)
+{
+	/* Don't touch the frame until the last one has gone */
+	spi_wait(dev);
+	ws2812_send(dev, frame, ws2812_pack(frame, colors, n_leds));
+}
@@ -0,0 +1,70 @@
+/* Basic WS2812/SK6812 Interface
+ *
+ * These strips use a single data wire. Each bit is a high pulse followed by
+ * a low one, with the length of the high pulse telling 0 from 1. The bit
+ * period is 1.25 us, and the line being held low for a while latches the
+ * data.
+ *
+ * To drive them from the SSP, MOSI runs at 2.4 MHz (3x the data rate) and
+ * each data bit becomes a 3 bit symbol:
+ *   0 -> 100 (0.42 us high)
+ *   1 -> 110 (0.83 us high)
+ * With 12-bit SSP frames, each frame carries one nibble of colour data.
+ *
+ * Like the LPD8806, each LED takes the first 24 bits it sees and passes
+ * the rest on, so only a prefix of the strip needs to be sent to change the
+ * first few LEDs.
+ */
+#ifndef __WS2812_H__
+#define __WS2812_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "spi.h"
+
+#define WS2812_SPI_RATE 2400000
+
+/* SSP frames for each LED - 24 bits, one nibble per frame */
+#define WS2812_WORDS_PER_LED 6
+
+/* Size of a packed frame (in SSP frames), including the trailing low word */
+#define WS2812_FRAME_SIZE(_n_leds) (((_n_leds) * WS2812_WORDS_PER_LED) + 1)
+
+/* Set up an SSP to drive a WS2812 strip
+ *
+ * The SSP must have been initialised with FRAMESZ_12BIT. A gap of more than
+ * a few microseconds in the middle of a frame would latch it early, so the
+ * SSP interrupt is raised to the highest priority.
+ */
+void ws2812_init(struct spi_dev *dev);
+
+/* Return true if WS2812_SPI_RATE can be hit exactly from 'pclk' Hz */
+bool ws2812_rate_ok(uint32_t pclk);
+
+/* Pack RGB values into a frame of SSP words
+ *
+ * Takes the same 0x00GGRRBB, 7 bits per component format as the LPD8806
+ * code. 'frame' must have room for WS2812_FRAME_SIZE(n_leds) words.
+ * Returns the number of words written.
+ */
+int ws2812_pack(uint16_t *frame, const uint32_t *colors, int n_leds);
+
+/* Stream a packed frame to the strip
+ *
+ * As lpd8806_send(). The strip latches once the line has been low for
+ * 50 us (280 us for newer parts) after the frame, so frames should be sent
+ * at least that far apart.
+ */
+void ws2812_send(struct spi_dev *dev, const uint16_t *frame, int len);
+
+/* Update a strip with RGB values
+ *
+ * Packs 'colors' into 'frame' (see ws2812_pack()) and sends it with
+ * ws2812_send().
+ * 'n_leds' can be less than the length of the strip, to only update the
+ * first n_leds LEDs.
+ */
+void ws2812_update(struct spi_dev *dev, uint16_t *frame, const uint32_t *colors,
+		int n_leds);
+
+#endif /* __WS2812_H__ */